@@ -0,0 +1,98 @@
+/*
+
+Benchmark of converting the area examined when the component can't be read
+from the decoded frame (eg. --channel b with YUV420P video) : converting
+the whole frame to RGB24 each frame, as --full-frame does (and as was done
+before the crop), against converting only the part containing the area,
+for centred areas of 5% to 100% of the width and height of a 1920x1080
+frame. frames/s is the most the conversion alone would allow.
+
+make bench
+
+*/
+
+#define main video_morse_decode_main
+#include "../video-morse-decode.cpp"
+#undef main
+
+#include <cstdio>
+
+namespace {
+
+const int frame_width = 1920, frame_height = 1080;
+const AVPixelFormat frame_format = AV_PIX_FMT_YUV420P;
+const AVPixelFormat convert_format = AV_PIX_FMT_RGB24;
+
+// microseconds per conversion of (x0,y0)-(x1,y1) of 'frame', over at least 0.2s
+double timeConversion(const AVFrame *frame, int x0, int y0, int x1, int y1)
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame_format);
+	x0 &= ~((1 << desc->log2_chroma_w) - 1);
+	y0 &= ~((1 << desc->log2_chroma_h) - 1);
+	const int width = x1 - x0, height = y1 - y0;
+
+	struct SwsContext *sws_ctx = sws_getContext(
+		width, height, frame_format,
+		width, height, convert_format, SWS_BILINEAR,
+		NULL, NULL, NULL
+	);
+	uint8_t *converted[4];
+	int converted_linesize[4];
+	av_image_alloc(converted, converted_linesize, width, height,
+		convert_format, 32);
+
+	long conversions = 0;
+	const auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double, std::micro> elapsed;
+	do {
+		const uint8_t *crop_data[4];
+		cropPlanes(frame, desc, x0, y0, crop_data);
+		sws_scale(sws_ctx, crop_data, frame->linesize, 0, height,
+			converted, converted_linesize);
+		conversions++;
+		elapsed = std::chrono::steady_clock::now() - start;
+	} while (elapsed.count() < 200000);
+
+	av_freep(&converted[0]);
+	sws_freeContext(sws_ctx);
+	return elapsed.count() / conversions;
+}
+
+}
+
+int main()
+{
+	AVFrame *frame = av_frame_alloc();
+	frame->width = frame_width;
+	frame->height = frame_height;
+	frame->format = frame_format;
+	av_image_alloc(frame->data, frame->linesize, frame_width, frame_height,
+		frame_format, 32);
+	for (int plane = 0; plane < 3; plane++) {
+		const int rows = plane ? frame_height / 2 : frame_height;
+		for (int y = 0; y < rows; y++) {
+			for (int x = 0; x < frame->linesize[plane]; x++) {
+				frame->data[plane][y * frame->linesize[plane] + x] =
+					uint8_t(x * 7 + y * 13 + plane * 50);
+			}
+		}
+	}
+
+	printf("%8s %12s %12s %12s %12s %10s\n", "area", "full us", "crop us",
+		"full fps", "crop fps", "speedup");
+	for (const int percent : { 5, 10, 20, 50, 100 }) {
+		const int width = frame_width * percent / 100;
+		const int height = frame_height * percent / 100;
+		const int x0 = (frame_width - width) / 2, y0 = (frame_height - height) / 2;
+		const double full = timeConversion(frame, 0, 0, frame_width, frame_height);
+		const double crop = timeConversion(frame, x0, y0, x0 + width, y0 + height);
+		char area[16];
+		snprintf(area, sizeof(area), "%d%%", percent);
+		printf("%8s %12.1f %12.1f %12.0f %12.0f %9.1fx\n", area,
+			full, crop, 1e6 / full, 1e6 / crop, full / crop);
+	}
+
+	av_freep(&frame->data[0]);
+	av_frame_free(&frame);
+	return 0;
+}
@@ -0,0 +1,197 @@
+/*
+
+Benchmark of decoding dots and dashes : the decoder which ran replace_all()
+for each symbol, against the single pass with MorseCode and the lookup
+table which decodeSignals() uses now, over random messages of 10KB to 10MB.
+The previous decoder is quadratic, so is only timed up to 160KB.
+
+make bench
+
+*/
+
+#define main video_morse_decode_main
+#include "../video-morse-decode.cpp"
+#undef main
+
+#include <cstdio>
+#include <random>
+
+namespace {
+
+// replace first occurance of 'from' with 'to', in 'input'
+bool replace(
+	std::string& input,
+	const std::string& from,
+	const std::string& to
+) {
+	size_t start_pos = input.find(from);
+	if (start_pos == std::string::npos) {
+		return false;
+	}
+	input.replace(start_pos, from.length(), to);
+	return true;
+}
+
+// return a copy of 'input' with all occurances of 'from' replaced with 'to'
+std::string replace_all(
+	const std::string & input,
+	const std::string& from,
+	const std::string& to
+) {
+	std::string out = input;
+	while (replace(out, from, to));
+	return out;
+}
+
+struct PreviousSymbol {
+	std::string pattern, string;
+};
+
+const PreviousSymbol previous_symbols[] = {
+	{ ".-"   , "A" },
+	{ "-..." , "B" },
+	{ "-.-." , "C" },
+	{ "-.."  , "D" },
+	{ "."    , "E" },
+	{ "..-." , "F" },
+	{ "--."  , "G" },
+	{ "...." , "H" },
+	{ ".."   , "I" },
+	{ ".---" , "J" },
+	{ "-.-"  , "K" },
+	{ ".-.." , "L" },
+	{ "--"   , "M" },
+	{ "-."   , "N" },
+	{ "---"  , "O" },
+	{ ".--." , "P" },
+	{ "--.-" , "Q" },
+	{ ".-."  , "R" },
+	{ "..."  , "S" },
+	{ "-"    , "T" },
+	{ "..-"  , "U" },
+	{ "...-" , "V" },
+	{ ".--"  , "W" },
+	{ "-..-" , "X" },
+	{ "-.--" , "Y" },
+	{ "--.." , "Z" },
+	{ "-----", "0" },
+	{ ".----", "1" },
+	{ "..---", "2" },
+	{ "...--", "3" },
+	{ "....-", "4" },
+	{ ".....", "5" },
+	{ "-....", "6" },
+	{ "--...", "7" },
+	{ "---..", "8" },
+	{ "----.", "9" },
+	{ "---...", ":" },
+	{ "-....-", "-" },
+	{ ".-.-.-", "." }
+};
+
+// the decoder before the lookup table, 'in' having a space at each end
+std::string previousDecodeMorse(const std::string & in)
+{
+	std::string out = in;
+
+	for (const auto & m : previous_symbols) {
+		std::string from = std::string(" ") + m.pattern + " ";
+		std::string to   = std::string(" ") + m.string + " ";
+		out = replace_all(out, from, to);
+	}
+
+	out = replace_all(out, " ", "");
+	out = replace_all(out, "|", " ");
+
+	return out;
+}
+
+// the same dots and dashes decoded a symbol at a time, as decodeSignals() does
+std::string decodeMorse(const std::string & in)
+{
+	std::string out;
+	MorseCode code;
+
+	auto add_symbol = [&]() {
+		const char *symbol = morse_tables[0].lookup(code.code());
+		out += symbol ? symbol : morse_unknown;
+		code.clear();
+	};
+
+	for (const char c : in) {
+		if (c == '.' || c == '-') {
+			code.add(c == '-');
+		} else if (!code.empty()) {
+			add_symbol();
+		}
+		if (c == '|') {
+			out += " ";
+		}
+	}
+	if (!code.empty()) {
+		add_symbol();
+	}
+	return out;
+}
+
+// random words of 1-8 symbols, as morseText() writes them, of about 'size' bytes
+std::string randomMorse(size_t size)
+{
+	std::mt19937 random(1);
+	const size_t symbols = sizeof(previous_symbols) / sizeof(previous_symbols[0]);
+	std::string morse = " ";
+	while (morse.size() < size) {
+		const int letters = 1 + random() % 8;
+		for (int i = 0; i < letters; i++) {
+			morse += previous_symbols[random() % symbols].pattern + " ";
+		}
+		morse += "| ";
+	}
+	return morse;
+}
+
+// milliseconds taken by f()
+template <typename F>
+double timeCall(F f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	const std::chrono::duration<double, std::milli> elapsed =
+		std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+}
+
+int main()
+{
+	const size_t max_previous_size = 160 << 10;
+
+	printf("%10s %14s %14s %14s %14s\n",
+		"bytes", "previous ms", "ns/byte", "lookup ms", "ns/byte");
+
+	for (size_t size = 10 << 10; size <= 16 << 20; size *= 4) {
+		const std::string morse = randomMorse(size);
+		std::string message;
+		const double t = timeCall([&]() {
+			message = decodeMorse(morse);
+		});
+
+		printf("%10zu", morse.size());
+		if (size <= max_previous_size) {
+			std::string previous;
+			const double p = timeCall([&]() {
+				previous = previousDecodeMorse(morse);
+			});
+			if (previous != message) {
+				fprintf(stderr, "messages differ at %zu bytes\n", morse.size());
+				return 1;
+			}
+			printf(" %14.2f %14.1f", p, p * 1e6 / morse.size());
+		} else {
+			printf(" %14s %14s", "-", "-");
+		}
+		printf(" %14.2f %14.1f\n", t, t * 1e6 / morse.size());
+	}
+	return 0;
+}
@@ -0,0 +1,110 @@
+/*
+
+Benchmark of finding the peaks of the pulse durations : counting them in
+a std::map and copying it to a vector as long as the longest duration, as
+processSignals() did, against counting them in a DurationHistogram, for
+5M signals of 25fps morse with 1% long pauses (1 minute to 1 hour), with
+bins of a frame and of a millisecond.
+
+make bench
+
+*/
+
+#define main video_morse_decode_main
+#include "../video-morse-decode.cpp"
+#undef main
+
+#include <cstdio>
+#include <map>
+#include <random>
+
+namespace {
+
+// peaks of 'durations' from a std::map, in bins of 'bin_width'
+std::vector<int> previousPeaks(const std::vector<int64_t> & durations,
+	int64_t bin_width, const std::vector<double> & kernel)
+{
+	std::map<int, int> vf;
+	for (const int64_t duration : durations) {
+		vf[int((duration + bin_width / 2) / bin_width)]++;
+	}
+
+	std::vector<int> s(vf.rbegin()->first + 1);
+	for (const auto & e : vf) {
+		s[e.first] = e.second;
+	}
+	return get_local_maximums(s, 2, kernel);
+}
+
+// the same from a DurationHistogram
+std::vector<int> histogramPeaks(const std::vector<int64_t> & durations,
+	int64_t bin_width, const std::vector<double> & kernel)
+{
+	DurationHistogram hist;
+	hist.setBinWidth(bin_width);
+	for (const int64_t duration : durations) {
+		hist.add(duration);
+	}
+	return get_local_maximums(hist.dense(), 2, kernel);
+}
+
+// pulses of 1 or 3 units of 3 frames, with up to half a frame of jitter,
+// and 1 in 'outlier_every' a pause of 1 minute to 1 hour
+std::vector<int64_t> randomDurations(size_t count, int outlier_every)
+{
+	const int64_t frame = 40000, unit = 3 * frame;
+	std::mt19937 random(1);
+	std::uniform_int_distribution<int64_t> jitter(-frame / 2, frame / 2);
+	std::uniform_int_distribution<int64_t> pause(60000000, 3600000000);
+	std::vector<int64_t> durations(count);
+	for (auto & duration : durations) {
+		if (random() % outlier_every == 0) {
+			duration = pause(random);
+		} else {
+			duration = (random() % 2 ? 3 * unit : unit) + jitter(random);
+		}
+	}
+	return durations;
+}
+
+// milliseconds taken by f()
+template <typename F>
+double timeCall(F f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	const std::chrono::duration<double, std::milli> elapsed =
+		std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+}
+
+int main()
+{
+	const std::vector<int64_t> durations = randomDurations(5000000, 100);
+	const std::vector<double> kernel = gaussianKernel(3, 0.7071);
+
+	printf("%10s %14s %14s %10s\n", "bin us", "std::map ms", "dense ms", "speedup");
+
+	for (const int64_t bin_width : { 40000, 1000 }) {
+		// best of a few runs
+		double previous = 1e30, dense = 1e30;
+		std::vector<int> previous_peaks, dense_peaks;
+		for (int run = 0; run < 3; run++) {
+			previous = std::min(previous, timeCall([&]() {
+				previous_peaks = previousPeaks(durations, bin_width, kernel);
+			}));
+			dense = std::min(dense, timeCall([&]() {
+				dense_peaks = histogramPeaks(durations, bin_width, kernel);
+			}));
+		}
+		if (previous_peaks != dense_peaks) {
+			fprintf(stderr, "peaks differ with %lldus bins\n", (long long)bin_width);
+			return 1;
+		}
+		printf("%10lld %14.2f %14.2f %9.1fx\n",
+			(long long)bin_width, previous, dense, previous / dense);
+	}
+	return 0;
+}
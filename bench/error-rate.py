@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""
+Decode the corpus written by bench/morse-corpus.py with each of a few sets
+of options, and print the character error rate (edit distance from the
+message sent, over the length of the messages) and the number of clips
+decoded exactly.
+
+bench/error-rate.py [--decoder <path>] [--options "<options>"]... <directory>
+
+The clips are decoded with --batch and --channel y. Without --options, the
+sets compared are the defaults, --hysteresis 0.3, --debounce 2 and both.
+"""
+
+import argparse
+import json
+import os
+import shlex
+import subprocess
+import sys
+
+OPTION_SETS = [
+	"",
+	"--hysteresis 0.3",
+	"--debounce 2",
+	"--hysteresis 0.3 --debounce 2",
+]
+
+
+def edit_distance(a, b):
+	"""levenshtein distance between strings 'a' and 'b'"""
+	d = list(range(len(b) + 1))
+	for i, ca in enumerate(a, 1):
+		previous, d[0] = d[:], i
+		for j, cb in enumerate(b, 1):
+			d[j] = min(previous[j] + 1, d[j - 1] + 1, previous[j - 1] + (ca != cb))
+	return d[-1]
+
+
+def read_manifest(path):
+	"""video file name -> message sent, from the comment before each"""
+	expected, message = {}, None
+	with open(path) as f:
+		for line in f:
+			line = line.strip()
+			if line.startswith("#"):
+				message = line[1:].strip()
+			elif line:
+				expected[line.rsplit(None, 6)[0]] = message
+	return expected
+
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("directory")
+	parser.add_argument("--decoder", default="./video-morse-decode")
+	parser.add_argument("--options", action="append")
+	args = parser.parse_args()
+
+	manifest = os.path.join(args.directory, "manifest.txt")
+	expected = read_manifest(manifest)
+
+	print("%-32s %8s %8s" % ("options", "CER", "exact"))
+	for options in args.options or OPTION_SETS:
+		# a non-zero exit only means some clips failed, which count as errors
+		output = subprocess.run(
+			[args.decoder, "--batch", manifest, "--channel", "y"]
+			+ shlex.split(options) + ["-"],
+			stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+			universal_newlines=True).stdout
+
+		errors = length = exact = 0
+		decoded = {}
+		for line in output.splitlines():
+			report = json.loads(line)
+			decoded[report["video"]] = report.get("message", "").strip()
+		for video, message in expected.items():
+			received = decoded.get(video, "")
+			errors += edit_distance(received, message)
+			length += len(message)
+			exact += received == message
+		print("%-32s %7.1f%% %5d/%d" % (options or "defaults",
+			100.0 * errors / length, exact, len(expected)))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""
+Write a corpus of noisy synthetic morse videos, for bench/error-rate.py.
+
+bench/morse-corpus.py <directory>
+
+Each video is a small uncompressed YUV4MPEG2 (.y4m) clip at 25fps, with a
+lamp in the centre fifth of the frame keying one of 3 messages, for each
+of :
+	2 speeds : 4 and 6 frames per unit
+	single frame glitches : 0, 1, 2 and 4% of frames inverted
+	flicker : the whole frame's luminance moved by up to 0, 30 or 60 a frame
+72 clips in all, about 70MB. The noise is seeded from the clip's name, so
+the corpus is the same each time.
+
+<directory>/manifest.txt lists the clips for --batch, each after a comment
+with the message it sends.
+"""
+
+import os
+import random
+import sys
+
+WIDTH, HEIGHT = 32, 24
+FRAME_RATE = 25
+OFF_LEVEL, ON_LEVEL = 30, 200
+
+MESSAGES = ["SOS HELLO WORLD", "CQ CQ DE K1ABC", "THE QUICK BROWN FOX"]
+FRAMES_PER_UNIT = [4, 6]
+GLITCH_PERCENT = [0, 1, 2, 4]
+FLICKER = [0, 30, 60]
+
+MORSE = {
+	"A": ".-", "B": "-...", "C": "-.-.", "D": "-..", "E": ".", "F": "..-.",
+	"G": "--.", "H": "....", "I": "..", "J": ".---", "K": "-.-", "L": ".-..",
+	"M": "--", "N": "-.", "O": "---", "P": ".--.", "Q": "--.-", "R": ".-.",
+	"S": "...", "T": "-", "U": "..-", "V": "...-", "W": ".--", "X": "-..-",
+	"Y": "-.--", "Z": "--..",
+	"0": "-----", "1": ".----", "2": "..---", "3": "...--", "4": "....-",
+	"5": ".....", "6": "-....", "7": "--...", "8": "---..", "9": "----.",
+}
+
+
+def lamp_states(message, frames_per_unit):
+	"""state of the lamp (0 or 1) in each frame, with 10 units off either side"""
+	units = [0] * 10
+	for word in message.split():
+		for letter in word:
+			for element in MORSE[letter]:
+				units += [1] * (1 if element == "." else 3) + [0]
+			units += [0] * 2
+		units += [0] * 4
+	units += [0] * 6
+	return [state for state in units for _ in range(frames_per_unit)]
+
+
+def write_clip(path, states, glitch_percent, flicker, rng):
+	"""write the frames of 'states' to 'path', with glitches and flicker"""
+	x0, x1 = WIDTH * 4 // 10, WIDTH * 6 // 10
+	y0, y1 = HEIGHT * 4 // 10, HEIGHT * 6 // 10
+	chroma = bytes([128]) * (WIDTH // 2 * HEIGHT // 2 * 2)
+
+	with open(path, "wb") as f:
+		f.write(b"YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n"
+			% (WIDTH, HEIGHT, FRAME_RATE))
+		for state in states:
+			if rng.random() * 100 < glitch_percent:
+				state = 1 - state
+			offset = rng.randint(-flicker, flicker)
+			off = min(max(OFF_LEVEL + offset, 0), 255)
+			on = min(max((ON_LEVEL if state else OFF_LEVEL) + offset, 0), 255)
+			row = bytes([off]) * WIDTH
+			lamp_row = bytes([off]) * x0 + bytes([on]) * (x1 - x0) \
+				+ bytes([off]) * (WIDTH - x1)
+			f.write(b"FRAME\n")
+			for y in range(HEIGHT):
+				f.write(lamp_row if y0 <= y < y1 else row)
+			f.write(chroma)
+
+
+def main():
+	if len(sys.argv) != 2:
+		sys.stderr.write("usage: %s <directory>\n" % sys.argv[0])
+		return 1
+	directory = sys.argv[1]
+	os.makedirs(directory, exist_ok=True)
+
+	with open(os.path.join(directory, "manifest.txt"), "w") as manifest:
+		for message in MESSAGES:
+			for frames_per_unit in FRAMES_PER_UNIT:
+				states = lamp_states(message, frames_per_unit)
+				for glitch_percent in GLITCH_PERCENT:
+					for flicker in FLICKER:
+						name = "%s-%dfpu-glitch%d-flicker%d.y4m" % (
+							message.replace(" ", "_").lower(),
+							frames_per_unit, glitch_percent, flicker)
+						path = os.path.abspath(os.path.join(directory, name))
+						write_clip(path, states, glitch_percent, flicker,
+							random.Random(name))
+						manifest.write("# %s\n%s 0 -1 0.4 0.4 0.6 0.6\n"
+							% (message, path))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
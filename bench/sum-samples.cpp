@@ -0,0 +1,128 @@
+/*
+
+Microbenchmark of the area reduction : the loop processFrame used before
+the SIMD kernels, against sumSamples() and each kernel it can choose
+from, over square areas of planar (step 1) and packed RGB24 (step 3)
+samples of a 3840x2160 frame.
+
+make bench
+
+*/
+
+#define main video_morse_decode_main
+#include "../video-morse-decode.cpp"
+#undef main
+
+#include <cstdio>
+
+namespace {
+
+const int frame_width = 3840, frame_height = 2160;
+
+// average of the area as processFrame found it before : clamping each
+// sample, and truncating the average of each row
+unsigned previousLoop(const uint8_t *data, int linesize, int step,
+	int x0, int y0, int x1, int y1)
+{
+	int i, x, y, s = 0, t = 0;
+	for (y = y0; y < y1; y++) {
+		const uint8_t *row = data + y * linesize;
+		s = 0;
+		for (x = x0; x < x1; x++) {
+			i = (int)row[x * step];
+			if (i < 0) { i = 0; }
+			if (i > 255) { i = 255; }
+			s += i;
+		}
+		t += s / (x1 - x0);
+	}
+	return t / (y1 - y0);
+}
+
+// average of the area with 'sum', a row at a time as processFrame does now
+unsigned kernelLoop(SumSamplesFunction sum, const uint8_t *data,
+	int linesize, int step, int x0, int y0, int x1, int y1)
+{
+	uint64_t total = 0;
+	for (int y = y0; y < y1; y++) {
+		total += sum(data + y * linesize + x0 * step, x1 - x0, step);
+	}
+	return total / ((uint64_t)(x1 - x0) * (y1 - y0));
+}
+
+// microseconds per call of 'f', repeated for at least 0.1s
+template <typename F>
+double timeCall(F f)
+{
+	volatile unsigned sink = 0;
+	long calls = 0;
+	const auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double, std::micro> elapsed;
+	do {
+		for (int i = 0; i < 16; i++) {
+			sink += f();
+		}
+		calls += 16;
+		elapsed = std::chrono::steady_clock::now() - start;
+	} while (elapsed.count() < 100000);
+	return elapsed.count() / calls;
+}
+
+}
+
+int main()
+{
+	struct Kernel {
+		const char *name;
+		SumSamplesFunction f;
+	};
+	std::vector<Kernel> kernels { { "scalar", sumSamplesScalar } };
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		kernels.push_back({ "sse2", sumSamplesSSE2 });
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		kernels.push_back({ "avx2", sumSamplesAVX2 });
+	}
+#endif
+
+	for (const int step : { 1, 3 }) {
+		const int linesize = frame_width * step;
+		std::vector<uint8_t> frame((size_t)linesize * frame_height);
+		for (size_t i = 0; i < frame.size(); i++) {
+			frame[i] = uint8_t(i * 7 + i / linesize * 13);
+		}
+
+		printf("%s, microseconds per frame :\n%10s %10s",
+			step == 1 ? "planar" : "rgb24", "area", "previous");
+		for (const auto & kernel : kernels) {
+			printf(" %10s", kernel.name);
+		}
+		printf(" %10s\n", "speedup");
+
+		for (const int side : { 16, 64, 256, 1024, 2048 }) {
+			const int x0 = (frame_width - side) / 2, y0 = (frame_height - side) / 2;
+			const int x1 = x0 + side, y1 = y0 + side;
+			const double previous = timeCall([&]() {
+				return previousLoop(frame.data(), linesize, step, x0, y0, x1, y1);
+			});
+			char area[32];
+			snprintf(area, sizeof(area), "%dx%d", side, side);
+			printf("%10s %10.2f", area, previous);
+
+			double fastest = previous;
+			for (const auto & kernel : kernels) {
+				const double t = timeCall([&]() {
+					return kernelLoop(kernel.f, frame.data(), linesize, step,
+						x0, y0, x1, y1);
+				});
+				fastest = std::min(fastest, t);
+				printf(" %10.2f", t);
+			}
+			printf(" %9.1fx\n", previous / fastest);
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -4,7 +4,8 @@ Decode morse code from video.
 
 Usage :
 
-video-morse-decode <video_filename> <start_frame> <end_frame> <x0> <y0> <x1> <y1>
+video-morse-decode [options] <video_filename> <json_filename> <start_frame> <end_frame> <x0> <y0> <x1> <y1>
+video-morse-decode --batch <manifest> [--jobs <n>] [options] <json_filename>
 
 Example :
 
@@ -14,16 +15,47 @@ youtube-dl https://www.youtube.com/watch?v=... --output video.mp4
 Options :
 
 <video_filename> : MPEG4, AVI, FLV etc - anything FFmpeg supports
+                   - = stdin, URLs (udp://, rtsp:// etc) and /dev/video* devices
 <start_frame>    : 0 = start from first frame, 30 = skip 1 second (if 30fps)
 <end_frame>      : -1 = end at last frame, 60 = end at 2 second (if 30fps)
 <x0> <y0>        : coordinates of top-left area to examine (0.0-1.0)
 <x1> <y1>        : coordinates of bottom-right area to examine (0.0-1.0)
 
+--no-morse       : leave the dots and dashes out of the JSON report
+--alphabet <a>   : letters to decode, one of latin,cyrillic,greek (default latin)
+--prosigns       : decode AR, AS, BT and KN as <AR> etc rather than + & = (
+--threshold <t>  : on/off threshold, one of mean (of all frames, default), otsu, kmeans, or adaptive to follow changes in lighting
+--adapt-frames <n> : time constant of the adaptive threshold's on and off levels, in frames (default 30)
+--hysteresis <h> : change state only <h> of the contrast between on and off past the threshold (0-1, default 0)
+--debounce <n>   : ignore changes of state lasting less than <n> frames (default 1)
+--interpolate <i> : time edges between frames from the luminance, one of none (default), linear, parabolic
+--histogram-bin <us> : width of the pulse and gap duration histogram bins in microseconds (at least 30), 0 = one frame, or half with --interpolate (default)
+--smooth-window <n> : taps either side of the gaussian filter applied to duration histograms (default 3)
+--smooth-sigma <s>  : standard deviation of the filter, in taps (default 0.7071)
+--stream         : print each letter to stdout as soon as it's received
+--live           : treat input as live (implies --stream), detected for pipes, network streams and devices
+--format <name>  : FFmpeg input format, eg. mpegts, if it can't be detected
+--history <n>    : only keep the last <n> frames for the report, 0 = all (default, 65536 if live)
+--threads <n>    : number of decoding threads, 0 = one per core (default)
+--batch <file>   : decode each video listed in <file>, a line each : <video_filename> <start_frame> <end_frame> <x0> <y0> <x1> <y1>
+--jobs <n>       : number of videos decoded at once with --batch, 0 = one per core (default)
+--area <x0,y0,x1,y1> : another area to decode, as well as <x0> <y0> <x1> <y1> (can be repeated)
+--locate <n>     : search <x0> <y0> <x1> <y1> for up to <n> blinking lamps, and decode them
+--locate-cells <n> : columns of the grid of cells searched by --locate (default 32)
+--track          : follow the lamp in each area as it, or the camera, moves
+--lowres <n>     : decode at 1/2^<n> of the width and height, where the codec can (0-3, default 0)
+--fast-decode    : skip the loop filter, and allow other shortcuts which don't follow the standard
+--compare-full   : decode again at full resolution and quality, and report the difference
+--no-seek        : decode from the first frame, rather than seeking to <start_frame>
+--channel <c>    : colour component to examine, one of r,g,b,y,u,v (default b)
+--convert        : always convert with swscale, even if the component can be read directly
+--full-frame     : convert the whole frame, not just the area examined
+
 Compile :
 
-g++ -O2 -std=c++14 $(pkg-config --cflags-only-I libavcodec) \
+g++ -O2 -std=c++14 -pthread $(pkg-config --cflags-only-I libavcodec) \
 -o video-morse-decode video-morse-decode.cpp \
-$(pkg-config --libs-only-l libavcodec libavutil \
+$(pkg-config --libs-only-l libavcodec libavdevice libavutil \
 libavfilter libavformat libswscale) -lm
 
 */
@@ -31,49 +63,38 @@ libavfilter libavformat libswscale) -lm
 extern "C"
 {
 #include <libavcodec/avcodec.h>
+#include <libavdevice/avdevice.h>
 #include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <libswscale/swscale.h>
 }
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include <csignal>
 #include <cstdint>
 #include <cmath>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <iostream>
-#include <map>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <fstream>
 #include <sstream>
+#include <thread>
 #include <utility>
 #include <vector>
 
 namespace Util {
 
-// replace first occurance of 'from' with 'to', in 'input'
-bool replace(
-	std::string& input,
-	const std::string& from,
-	const std::string& to
-) {
-	size_t start_pos = input.find(from);
-	if (start_pos == std::string::npos) {
-		return false;
-	}
-	input.replace(start_pos, from.length(), to);
-	return true;
-}
-
-// return a copy of 'input' with all occurances of 'from' replaced with 'to'
-std::string replace_all(
-	const std::string & input,
-	const std::string& from,
-	const std::string& to
-) {
-	std::string out = input;
-	while (replace(out, from, to));
-	return out;
-}
-
 template <typename T>
 T sign(const T & x)
 {
@@ -87,12 +108,146 @@ double gaussian(double x, double a)
 	return sqrt(a / M_PI) * pow(M_E, -a * x * x);
 }
 
+/*
+luminance histogram 'hist' split into frames below 't' and frames from
+'t' up : the ratio of the variance between the two classes to the total
+variance (Otsu's separability, 0-1). near 1, the frames are clearly on or
+off. also returns the difference between the mean luminance of the two
+classes in 'contrast'.
+*/
+double separability(
+	const std::vector<unsigned> & hist, int t, double *contrast = NULL
+)
+{
+	const int bins = hist.size();
+	double n = 0, total = 0, squares = 0, n0 = 0, total0 = 0;
+	for (int i = 0; i < bins; i++) {
+		n += hist[i];
+		total += double(i) * hist[i];
+		squares += double(i) * i * hist[i];
+		if (i < t) {
+			n0 += hist[i];
+			total0 += double(i) * hist[i];
+		}
+	}
+
+	double variance = 0, between_variance = 0, d = 0;
+	if (n > 0) {
+		const double mean = total / n;
+		variance = squares / n - mean * mean;
+	}
+	if (n0 > 0 && n0 < n) {
+		d = (total - total0) / (n - n0) - total0 / n0;
+		between_variance = n0 * (n - n0) * d * d / (n * n);
+	}
+	if (contrast) {
+		*contrast = d;
+	}
+	return variance > 0 ? between_variance / variance : 0;
+}
+
+/*
+threshold of a luminance histogram which maximises the variance between
+the frames below it and the rest (Otsu's method). O(bins).
+*/
+int otsuThreshold(const std::vector<unsigned> & hist)
+{
+	const int bins = hist.size();
+	double n = 0, total = 0;
+	for (int i = 0; i < bins; i++) {
+		n += hist[i];
+		total += double(i) * hist[i];
+	}
+
+	// when there's a gap in the histogram, every threshold in it is best :
+	// take the middle
+	int best = 0, best_end = 0;
+	double best_variance = -1, n0 = 0, total0 = 0;
+	for (int t = 1; t < bins; t++) {
+		n0 += hist[t - 1];
+		total0 += double(t - 1) * hist[t - 1];
+		if (n0 == 0 || n0 == n) {
+			continue;
+		}
+		const double d = total0 / n0 - (total - total0) / (n - n0);
+		const double variance = n0 * (n - n0) * d * d;
+		if (variance > best_variance * (1 + 1e-12)) {
+			best_variance = variance;
+			best = best_end = t;
+		} else if (variance >= best_variance * (1 - 1e-12)) {
+			best_end = t;
+		}
+	}
+	return (best + best_end) / 2;
+}
+
+/*
+threshold of a luminance histogram half way between two centroids,
+found by k-means starting from the darkest and brightest frames.
+each iteration is O(bins), using cumulative counts and sums.
+*/
+int kmeansThreshold(const std::vector<unsigned> & hist)
+{
+	const int bins = hist.size();
+	std::vector<double> counts(bins + 1), sums(bins + 1);
+	int lowest = -1, highest = -1;
+	for (int i = 0; i < bins; i++) {
+		counts[i + 1] = counts[i] + hist[i];
+		sums[i + 1] = sums[i] + double(i) * hist[i];
+		if (hist[i]) {
+			highest = i;
+			if (lowest == -1) {
+				lowest = i;
+			}
+		}
+	}
+	if (lowest == -1) {
+		return 0;
+	}
+
+	// frames from 't' up belong to the brighter centroid
+	double c0 = lowest, c1 = highest;
+	int t = -1;
+	for (int iteration = 0; iteration < bins; iteration++) {
+		const int next = std::min(int(std::floor((c0 + c1) / 2)) + 1, bins);
+		if (next == t) {
+			break;
+		}
+		t = next;
+		if (counts[t] > 0) {
+			c0 = sums[t] / counts[t];
+		}
+		if (counts[bins] - counts[t] > 0) {
+			c1 = (sums[bins] - sums[t]) / (counts[bins] - counts[t]);
+		}
+	}
+	return t;
+}
+
+/*
+weights of a gaussian filter 'window_size' taps either side of the
+centre, with standard deviation 'sigma' taps, summing to 1
+*/
+std::vector<double> gaussianKernel(int window_size, double sigma)
+{
+	std::vector<double> kernel(2 * window_size + 1);
+	double total = 0;
+	for (int j = -window_size; j <= window_size; j++) {
+		kernel[j + window_size] = gaussian(j, 1 / (2 * sigma * sigma));
+		total += kernel[j + window_size];
+	}
+	for (auto & w : kernel) {
+		w /= total;
+	}
+	return kernel;
+}
+
 /*
 return indexes of turning points, largest to smallest frequency.
 
 example:
-get_local_maximums(vf, 3, 1) ->
-where vf =
+get_local_maximums(vf, 3, gaussianKernel(1, 0.7071)) ->
+where vf (non-zero frequencies shown) =
 	0: 1
 	5: 17
 	8: 116   <- turning point: largest frequency, this is output first
@@ -110,32 +265,27 @@ where vf =
 return : [ 8, 51, 21 ]
 */
 std::vector<int> get_local_maximums(
-	const std::map<int, int> & vf, // value -> frequency pairs
+	const std::vector<int> & s, // frequency of each value
 	int count, // number of turning points required
-	int window_size // gaussian smoothing window size
+	const std::vector<double> & kernel // smoothing filter, from gaussianKernel()
 )
 {
-	std::vector<int> s(vf.rbegin()->first + 1);
-	std::vector<std::pair<int, int>> tp;
+	std::vector<std::pair<int, double>> tp;
 	std::vector<int> r;
 	int i = 0, d = 0;
 
-	// convert map to vector
-	for (const auto & e : vf) {
-		s[e.first] = e.second;
-	}
-
-	// gaussian filter
-	std::vector<int> o(s.size());
-	for (int i = 0; i < s.size(); i++) {
-		double t = 0;
-		for (int j = -window_size; j < window_size+1; j++) {
-			int k = i + j;
-			if (k >= 0 && k < s.size()) {
-				t += (double)s[k] * gaussian(j, 1);
-			}
+	// gaussian filter : o[i] = sum of s[i + j] * kernel[j + w], treating
+	// values beyond either end as 0
+	const int w = kernel.size() / 2;
+	const int n = s.size();
+	std::vector<double> in(n + 2 * w), o(n);
+	std::copy(s.begin(), s.end(), in.begin() + w);
+	for (int j = 0; j <= 2 * w; j++) {
+		const double k = kernel[j];
+		const double *x = in.data() + j;
+		for (int i = 0; i < n; i++) {
+			o[i] += x[i] * k;
 		}
-		o[i] = t;
 	}
 
 	// find local maximums
@@ -143,7 +293,7 @@ std::vector<int> get_local_maximums(
 	for (i = 1; i < o.size(); i++) {
 		d = sign(o[i] - o[i - 1]);
 		if (i > 0 && (ld == 1 || ld == 0) && d == -1) {
-			tp.push_back(std::pair<int, int>(i - 1, o[i-1]));
+			tp.push_back(std::pair<int, double>(i - 1, o[i-1]));
 		}
 		ld = d;
 	}
@@ -151,7 +301,7 @@ std::vector<int> get_local_maximums(
 	// last point rising?
 	if (d > 0) {
 		// add it
-		tp.push_back(std::pair<int, int>(i - 1, o[i-1]));
+		tp.push_back(std::pair<int, double>(i - 1, o[i-1]));
 	}
 
 	// get n first points ordered by high to low frequency
@@ -159,7 +309,7 @@ std::vector<int> get_local_maximums(
 		return a.second > b.second;
 	});
 
-	std::vector<std::pair<int, int>>::const_iterator tpi = tp.begin();
+	std::vector<std::pair<int, double>>::const_iterator tpi = tp.begin();
 	while (count && tpi != tp.end()) {
 		r.push_back(tpi->first);
 		tpi++;
@@ -169,68 +319,268 @@ std::vector<int> get_local_maximums(
 	return r;
 }
 
-static std::string decodeMorse(const std::string & in)
+struct MorseSymbol {
+	const char *pattern, *string;
+};
+
+// figures, punctuation (ITU-R M.1677-1 and common extensions) and
+// procedural signals that have no character of their own
+constexpr MorseSymbol morse_common[] = {
+	{ "-----"    , "0" },
+	{ ".----"    , "1" },
+	{ "..---"    , "2" },
+	{ "...--"    , "3" },
+	{ "....-"    , "4" },
+	{ "....."    , "5" },
+	{ "-...."    , "6" },
+	{ "--..."    , "7" },
+	{ "---.."    , "8" },
+	{ "----."    , "9" },
+	{ ".-.-.-"   , "." },
+	{ "--..--"   , "," },
+	{ "---..."   , ":" },
+	{ "..--.."   , "?" },
+	{ ".----."   , "'" },
+	{ "-....-"   , "-" },
+	{ "-..-."    , "/" },
+	{ "-.--."    , "(" },
+	{ "-.--.-"   , ")" },
+	{ ".-..-."   , "\"" },
+	{ "-...-"    , "=" },
+	{ ".-.-."    , "+" },
+	{ ".--.-."   , "@" },
+	{ "-.-.--"   , "!" },
+	{ ".-..."    , "&" },
+	{ "-.-.-."   , ";" },
+	{ "..--.-"   , "_" },
+	{ "...-..-"  , "$" },
+	{ "...-."    , "<SN>" }, // understood
+	{ "...-.-"   , "<SK>" }, // end of work
+	{ "-.-.-"    , "<KA>" }, // starting signal
+	{ "........" , "<HH>" }, // error
+	{ "...---...", "<SOS>" }
+};
+
+// letters, including common extended latin letters
+constexpr MorseSymbol morse_latin[] = {
+	{ ".-"   , "A" },
+	{ "-..." , "B" },
+	{ "-.-." , "C" },
+	{ "-.."  , "D" },
+	{ "."    , "E" },
+	{ "..-." , "F" },
+	{ "--."  , "G" },
+	{ "...." , "H" },
+	{ ".."   , "I" },
+	{ ".---" , "J" },
+	{ "-.-"  , "K" },
+	{ ".-.." , "L" },
+	{ "--"   , "M" },
+	{ "-."   , "N" },
+	{ "---"  , "O" },
+	{ ".--." , "P" },
+	{ "--.-" , "Q" },
+	{ ".-."  , "R" },
+	{ "..."  , "S" },
+	{ "-"    , "T" },
+	{ "..-"  , "U" },
+	{ "...-" , "V" },
+	{ ".--"  , "W" },
+	{ "-..-" , "X" },
+	{ "-.--" , "Y" },
+	{ "--.." , "Z" },
+	{ ".--.-", "À" },
+	{ ".-.-" , "Ä" },
+	{ "-.-..", "Ç" },
+	{ "..-..", "É" },
+	{ ".-..-", "È" },
+	{ "--.--", "Ñ" },
+	{ "---." , "Ö" },
+	{ "..--" , "Ü" },
+	{ "----" , "CH" }
+};
+
+// russian
+constexpr MorseSymbol morse_cyrillic[] = {
+	{ ".-"   , "А" },
+	{ "-..." , "Б" },
+	{ ".--"  , "В" },
+	{ "--."  , "Г" },
+	{ "-.."  , "Д" },
+	{ "."    , "Е" },
+	{ "...-" , "Ж" },
+	{ "--.." , "З" },
+	{ ".."   , "И" },
+	{ ".---" , "Й" },
+	{ "-.-"  , "К" },
+	{ ".-.." , "Л" },
+	{ "--"   , "М" },
+	{ "-."   , "Н" },
+	{ "---"  , "О" },
+	{ ".--." , "П" },
+	{ ".-."  , "Р" },
+	{ "..."  , "С" },
+	{ "-"    , "Т" },
+	{ "..-"  , "У" },
+	{ "..-." , "Ф" },
+	{ "...." , "Х" },
+	{ "-.-." , "Ц" },
+	{ "---." , "Ч" },
+	{ "----" , "Ш" },
+	{ "--.-" , "Щ" },
+	{ "--.--", "Ъ" },
+	{ "-.--" , "Ы" },
+	{ "-..-" , "Ь" },
+	{ "..-..", "Э" },
+	{ "..--" , "Ю" },
+	{ ".-.-" , "Я" }
+};
+
+constexpr MorseSymbol morse_greek[] = {
+	{ ".-"   , "Α" },
+	{ "-..." , "Β" },
+	{ "--."  , "Γ" },
+	{ "-.."  , "Δ" },
+	{ "."    , "Ε" },
+	{ "--.." , "Ζ" },
+	{ "...." , "Η" },
+	{ "-.-." , "Θ" },
+	{ ".."   , "Ι" },
+	{ "-.-"  , "Κ" },
+	{ ".-.." , "Λ" },
+	{ "--"   , "Μ" },
+	{ "-."   , "Ν" },
+	{ "-..-" , "Ξ" },
+	{ "---"  , "Ο" },
+	{ ".--." , "Π" },
+	{ ".-."  , "Ρ" },
+	{ "..."  , "Σ" },
+	{ "-"    , "Τ" },
+	{ "-.--" , "Υ" },
+	{ "..-." , "Φ" },
+	{ "----" , "Χ" },
+	{ "--.-" , "Ψ" },
+	{ ".--"  , "Ω" }
+};
+
+// procedural signals sharing a pattern with punctuation, used instead of
+// it with --prosigns
+constexpr MorseSymbol morse_prosigns[] = {
+	{ ".-.-." , "<AR>" }, // +, end of message
+	{ ".-..." , "<AS>" }, // &, wait
+	{ "-...-" , "<BT>" }, // =, break
+	{ "-.--." , "<KN>" } // (, invitation to a named station
+};
+
+const int max_morse_elements = 9;
+
+// dots and dashes as bits (dash = 1), after a leading 1 to mark the length
+constexpr unsigned morseCode(const char *pattern)
 {
-	struct MorseSymbol {
-		std::string pattern, string;
-	};
+	unsigned code = 1;
+	for (; *pattern; pattern++) {
+		code = code << 1 | (*pattern == '-');
+	}
+	return code;
+}
 
-	static const struct MorseSymbol morse_symbols[] = {
-		{ ".-"   , "A" },
-		{ "-..." , "B" },
-		{ "-.-." , "C" },
-		{ "-.."  , "D" },
-		{ "."    , "E" },
-		{ "..-." , "F" },
-		{ "--."  , "G" },
-		{ "...." , "H" },
-		{ ".."   , "I" },
-		{ ".---" , "J" },
-		{ "-.-"  , "K" },
-		{ ".-.." , "L" },
-		{ "--"   , "M" },
-		{ "-."   , "N" },
-		{ "---"  , "O" },
-		{ ".--." , "P" },
-		{ "--.-" , "Q" },
-		{ ".-."  , "R" },
-		{ "..."  , "S" },
-		{ "-"    , "T" },
-		{ "..-"  , "U" },
-		{ "...-" , "V" },
-		{ ".--"  , "W" },
-		{ "-..-" , "X" },
-		{ "-.--" , "Y" },
-		{ "--.." , "Z" },
-		{ "-----", "0" },
-		{ ".----", "1" },
-		{ "..---", "2" },
-		{ "...--", "3" },
-		{ "....-", "4" },
-		{ ".....", "5" },
-		{ "-....", "6" },
-		{ "--...", "7" },
-		{ "---..", "8" },
-		{ "----.", "9" },
-		{ "---...", ":" },
-		{ "-....-", "-" },
-		{ ".-.-.-", "." }
-	};
+// morse code -> string, NULL if not a symbol
+struct MorseTable {
+	const char *strings[2 << max_morse_elements];
 
-	std::string out = in;
+	// symbols in 'b' replace those in 'a' with the same pattern
+	template <size_t A, size_t B>
+	constexpr MorseTable(const MorseSymbol (&a)[A], const MorseSymbol (&b)[B])
+		: strings()
+	{
+		for (const auto & m : a) {
+			strings[morseCode(m.pattern)] = m.string;
+		}
+		for (const auto & m : b) {
+			strings[morseCode(m.pattern)] = m.string;
+		}
+	}
 
-	for (const auto & m : morse_symbols) {
-		std::string from = std::string(" ") + m.pattern + " ";
-		std::string to   = std::string(" ") + m.string + " ";
-		out = replace_all(out, from, to);
+	const char *lookup(uint64_t code) const
+	{
+		return code < sizeof(strings) / sizeof(strings[0])
+			? strings[code] : NULL;
 	}
+};
+
+constexpr MorseTable morse_tables[] = {
+	MorseTable(morse_common, morse_latin),
+	MorseTable(morse_common, morse_cyrillic),
+	MorseTable(morse_common, morse_greek)
+};
+constexpr const char *morse_alphabets[] = { "latin", "cyrillic", "greek" };
 
-	out = replace_all(out, " ", "");
-	out = replace_all(out, "|", " ");
+constexpr MorseTable morse_prosign_table(morse_prosigns, morse_prosigns);
 
+// marks a pattern which isn't a symbol, U+FFFD replacement character
+const char * const morse_unknown = "\xef\xbf\xbd";
+
+// escape 's' for a JSON string
+std::string jsonEscape(const std::string & s)
+{
+	std::string out;
+	for (const char c : s) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+		}
+		out += c;
+	}
 	return out;
 }
 
+// dots and dashes of a symbol as it's received, in the form of morseCode()
+class MorseCode {
+public :
+	void add(bool dash)
+	{
+		// longer than any symbol, so just keep the length
+		if (m_code < (uint64_t(1) << 63)) {
+			m_code = m_code << 1 | dash;
+		}
+	}
+
+	bool empty() const
+	{
+		return m_code == 1;
+	}
+
+	void clear()
+	{
+		m_code = 1;
+	}
+
+	uint64_t code() const
+	{
+		return m_code;
+	}
+
+	std::string pattern() const
+	{
+		std::string p;
+		for (uint64_t bit = highestBit() >> 1; bit; bit >>= 1) {
+			p += m_code & bit ? '-' : '.';
+		}
+		return p;
+	}
+
+private :
+	uint64_t highestBit() const
+	{
+		uint64_t bit = 1;
+		while (bit <= m_code >> 1) {
+			bit <<= 1;
+		}
+		return bit;
+	}
+
+	uint64_t m_code = 1;
+};
+
 template <typename T>
 T stringTo(const std::string & s)
 {
@@ -240,423 +590,3632 @@ T stringTo(const std::string & s)
 	return v;
 }
 
-}
-
-using namespace Util;
-
-class VideoMorseDecode {
+/*
+sequence which keeps only the last 'capacity' items pushed,
+or all of them if 'capacity' is 0
+*/
+template <typename T>
+class RingBuffer {
 public :
-	struct Options {
-		double x0, y0, x1, y1;
-		int start_frame, end_frame;
-		std::string json_file_name;
-		std::string video_file_name;
-	};
-
-	// summary of each frame
-	struct Frame {
-		unsigned time; // frame index (timestamp would be better)
-		unsigned luminance; // average luminance from selected area
-	};
+	explicit RingBuffer(size_t capacity = 0)
+		: m_capacity(capacity)
+	{
+	}
 
-	// store pulse or break signal duration
-	struct Signal {
-		unsigned state; // 0 = break, 1 = pulse
-		unsigned duration; // in frames
-	};
+	// only before anything is pushed
+	void setCapacity(size_t capacity)
+	{
+		m_capacity = capacity;
+	}
 
-	VideoMorseDecode();
+	// add 'item'. if that discards the oldest item, copy it to 'discarded'
+	// and return true.
+	bool push_back(const T & item, T & discarded)
+	{
+		if (m_capacity == 0 || m_items.size() < m_capacity) {
+			m_items.push_back(item);
+			return false;
+		}
+		discarded = m_items[m_first];
+		m_items[m_first] = item;
+		m_first = (m_first + 1) % m_capacity;
+		return true;
+	}
 
-	void processFrame(
-		const AVFrame *frame, int width, int height, int frame_index
-	);
+	size_t size() const
+	{
+		return m_items.size();
+	}
 
-	bool parseOptions(int argc, char *argv[]);
-	bool run();
+	// oldest first
+	const T & operator[](size_t i) const
+	{
+		return m_items[(m_first + i) % m_items.size()];
+	}
 
 private :
-	void calculateHistogram();
-	void processStateChanges();
-	std::string processSignals();
-
-	// command-line options
-	Options m_options;
-
-	// average luminance of frame -> number of frames
-	std::vector<unsigned> m_frame_luminance_histogram;
-
-	// stream to write JSON report
-	std::ostream * m_json_stream;
-	std::ofstream m_json_file;
-
-	std::vector<Frame> m_frames;
-	std::vector<Signal> m_signals;
-
-	int m_mean_luminance;
+	size_t m_capacity;
+	size_t m_first = 0; // index of oldest item
+	std::vector<T> m_items;
 };
 
-VideoMorseDecode::VideoMorseDecode()
-{
-	m_frame_luminance_histogram.resize(256);
-}
-
-void VideoMorseDecode::processFrame(
-	const AVFrame *frame, int width, int height, int frame_index
-)
-{
-	int r, g, b, i, x, y, s = 0, t = 0;
-	int x0 = width  * m_options.x0;
-	int y0 = height * m_options.y0;
-	int x1 = width  * m_options.x1;
-	int y1 = height * m_options.y1;
+// time base of durations (AV_TIME_BASE_Q is a C compound literal)
+const AVRational microseconds = { 1, 1000000 };
 
-	if (m_options.start_frame != -1 && frame_index < m_options.start_frame) {
-		// ignore frame
-		return;
+/*
+luminance of consecutively numbered frames, stored by column : a byte per
+frame, and a timestamp per frame only once they stop being regular.
+keeps the last 'capacity' frames, or all of them if 'capacity' is 0.
+*/
+class FrameStore {
+public :
+	// only before anything is pushed
+	void setCapacity(size_t capacity)
+	{
+		m_luminance.setCapacity(capacity);
+		m_timestamps.setCapacity(capacity);
 	}
 
-	if (m_options.end_frame != -1 && frame_index > m_options.end_frame) {
-		// ignore frame
-		return;
+	// nominal frame rate and time base of timestamps, if known
+	void setFrameRate(AVRational frame_rate, AVRational time_base)
+	{
+		m_frame_rate = frame_rate;
+		m_time_base = time_base;
 	}
 
-	t = 0;
-	for (y = y0; y < y1; y++) {
-		const uint8_t *row = (const uint8_t *)(frame->data[0]+y*frame->linesize[0]);
-		s = 0;
-		for (x = x0; x < x1; x++) {
-			r = (int)row[x*3];
-			g = (int)row[x*3+1];
-			b = (int)row[x*3+2];
-			i = b; // use blue channel, works best for the BF4 lantern
-			if (i < 0) { i = 0; }
-			if (i > 255) { i = 255; }
-			s += i;
+	// add the next frame. if that discards the oldest frame, copy its
+	// luminance to 'discarded' and return true.
+	bool push_back(
+		int frame_index, uint8_t luminance, int64_t timestamp,
+		uint8_t & discarded
+	)
+	{
+		if (m_luminance.size() == 0 && m_first_index == -1) {
+			m_first_index = frame_index;
+			m_base_index = frame_index;
+			m_base_timestamp = timestamp;
 		}
-		t += s / (x1 - x0);
-	}
-	t /= y1 - y0;
-	m_frame_luminance_histogram[t]++;
 
-	Frame f;
-	f.time = frame_index;
-	f.luminance = t;
-	m_frames.push_back(f);
-}
+		// without both timestamps there's nothing to compare (and
+		// AV_NOPTS_VALUE would overflow the subtraction)
+		if (m_regular && timestamp != AV_NOPTS_VALUE
+			&& m_base_timestamp != AV_NOPTS_VALUE && knownFrameRate()
+		) {
+			const int64_t error = timestamp - regularTimestamp(frame_index);
+			const int64_t half_frame =
+				av_rescale_q(1, av_inv_q(m_frame_rate), m_time_base) / 2;
+			if (std::abs(error) > half_frame) {
+				// keep timestamps from now on, starting with the frames so far
+				int64_t unused;
+				for (size_t i = 0; i < m_luminance.size(); i++) {
+					m_timestamps.push_back(
+						regularTimestamp(m_first_index + i), unused);
+				}
+				m_regular = false;
+			}
+		}
 
-void VideoMorseDecode::calculateHistogram()
-{
-	unsigned i, n, yi, j, y, sum = 0, max = 0;
+		if (!m_regular) {
+			int64_t unused;
+			m_timestamps.push_back(
+				timestamp != AV_NOPTS_VALUE ? timestamp
+				: m_timestamps[m_timestamps.size() - 1], unused);
+		}
 
-	m_mean_luminance = 0;
-	for (i = 0; i < 16; i++) {
-		for (j = 0; j < 16; j++) {
-			n = i * 16 + j;
-			m_mean_luminance += n * m_frame_luminance_histogram[n];
-			sum += m_frame_luminance_histogram[n];
+		if (m_luminance.push_back(luminance, discarded)) {
+			m_first_index++;
+			return true;
 		}
+		return false;
 	}
-	m_mean_luminance /= sum;
 
-	std::string delim = "";
+	size_t size() const
+	{
+		return m_luminance.size();
+	}
 
-	*m_json_stream << "\"frame_hist\": [";
-	for (const auto & e : m_frame_luminance_histogram) {
-		*m_json_stream << delim << e;
-		delim = ",";
+	// of the i'th frame kept, oldest first
+	uint8_t luminance(size_t i) const
+	{
+		return m_luminance[i];
 	}
-	*m_json_stream << "]\n";
 
-	*m_json_stream << ",\"frame_hist_mean\": " << m_mean_luminance << "\n";
-}
+	int index(size_t i) const
+	{
+		return m_first_index + i;
+	}
 
-void VideoMorseDecode::processStateChanges()
-{
-	int state = 0, last_state = 0, last_time = 0;
+	int64_t timestamp(size_t i) const
+	{
+		return m_regular ? regularTimestamp(index(i)) : m_timestamps[i];
+	}
 
-	for (const auto & frame : m_frames) {
-		if (frame.luminance < m_mean_luminance) {
-			state = 0;
-		} else if (frame.luminance >= m_mean_luminance) {
-			state = 1;
+	// in microseconds : from the timestamp, or from the index if there are
+	// no timestamps
+	int64_t time(size_t i) const
+	{
+		const int64_t t = timestamp(i);
+		if (t == AV_NOPTS_VALUE || m_time_base.num <= 0 || m_time_base.den <= 0) {
+			return index(i) * frameDuration();
 		}
-		if (state != last_state) {
-			Signal signal;
-			signal.state = last_state;
-			signal.duration = frame.time - last_time;
-			last_time = frame.time;
-			m_signals.push_back(signal);
+		return av_rescale_q(t, m_time_base, microseconds);
+	}
+
+	// nominal, in microseconds, 25fps if the frame rate isn't known
+	int64_t frameDuration() const
+	{
+		if (m_frame_rate.num <= 0 || m_frame_rate.den <= 0) {
+			return 1000000 / 25;
 		}
+		return av_rescale_q(1, av_inv_q(m_frame_rate), microseconds);
+	}
 
-		last_state = state;
+	bool regular() const
+	{
+		return m_regular;
 	}
-}
 
-std::string VideoMorseDecode::processSignals()
-{
-	std::map<int, int> off_hist, on_hist;
-	const int gaussian_window_size = 3;
+private :
+	bool knownFrameRate() const
+	{
+		return m_frame_rate.num > 0 && m_frame_rate.den > 0
+			&& m_time_base.num > 0 && m_time_base.den > 0;
+	}
 
-	for (const auto & signal : m_signals) {
-		if (signal.state == 0) {
-			off_hist[signal.duration]++;
-		} else {
-			on_hist[signal.duration]++;
+	// timestamp of frame 'frame_index' if the frame rate is constant
+	int64_t regularTimestamp(int frame_index) const
+	{
+		if (!knownFrameRate() || m_base_timestamp == AV_NOPTS_VALUE) {
+			return AV_NOPTS_VALUE;
 		}
+		return m_base_timestamp + av_rescale_q(frame_index - m_base_index,
+			av_inv_q(m_frame_rate), m_time_base);
 	}
 
-	auto off_time_peaks = get_local_maximums(off_hist, 3, gaussian_window_size);
-	std::sort(std::begin(off_time_peaks), std::end(off_time_peaks));
+	RingBuffer<uint8_t> m_luminance;
+	RingBuffer<int64_t> m_timestamps; // empty while regular
+	int m_first_index = -1; // of oldest frame kept
+	bool m_regular = true;
 
-	std::vector<int> off_thresholds(2);
-	off_thresholds[0] = (off_time_peaks[0] + off_time_peaks[1]) / 2;
-	off_thresholds[1] = (off_time_peaks[1] + off_time_peaks[2]) / 2;
+	AVRational m_frame_rate = { 0, 1 };
+	AVRational m_time_base = { 0, 1 };
+	int m_base_index = 0; // first frame pushed
+	int64_t m_base_timestamp = AV_NOPTS_VALUE;
+};
 
-	auto on_time_peaks = get_local_maximums(on_hist, 2, gaussian_window_size);
-	std::sort(std::begin(on_time_peaks), std::end(on_time_peaks));
+/*
+frequency of each duration, rounded to a multiple of the bin width (eg.
+one frame) : in a vector indexed by bin up to 'dense_duration', and in
+log-spaced bins (8 per doubling) above it, so that outliers such as a
+long pause don't make it huge. the dense part covers the same durations
+whatever the bin width, so the peaks of even the slowest morse are in it.
+*/
+class DurationHistogram {
+public :
+	static const int64_t dense_duration = 60000000; // microseconds
+	static const int64_t min_bin_width = 30; // at most 2M dense bins
+	static const int bins_per_octave = 8;
+
+	// only before anything is added
+	void setBinWidth(int64_t bin_width)
+	{
+		m_bin_width = bin_width > min_bin_width ? bin_width : min_bin_width;
+		m_dense_limit = dense_duration / m_bin_width;
+	}
 
-	std::vector<int> on_thresholds(1);
-	on_thresholds[0] = (on_time_peaks[0] + on_time_peaks[1]) / 2;
+	int64_t binWidth() const
+	{
+		return m_bin_width;
+	}
 
-	std::string morse;
-	for (const auto & signal : m_signals) {
-		if (signal.state == 0) {
-			if (signal.duration < off_thresholds[0]) {
-				// next symbol
-			} else if (signal.duration >= off_thresholds[0] && signal.duration < off_thresholds[1]) {
-				morse += " ";
-			} else if (signal.duration >= off_thresholds[1]) {
-				morse += " | ";
+	void add(int64_t duration)
+	{
+		const int64_t bin = std::max<int64_t>(
+			(duration + m_bin_width / 2) / m_bin_width, 0);
+		if (bin < m_dense_limit) {
+			if (size_t(bin) >= m_dense.size()) {
+				m_dense.resize(bin + 1);
 			}
+			m_dense[bin]++;
 		} else {
-			if (signal.duration < on_thresholds[0]) {
-				morse += ".";
-			} else if (signal.duration >= on_thresholds[0]) {
-				morse += "-";
+			const size_t overflow = overflowBin(bin);
+			if (overflow >= m_overflow.size()) {
+				m_overflow.resize(overflow + 1);
 			}
+			m_overflow[overflow]++;
 		}
 	}
 
-	std::string delim;
+	// frequency of each bin below dense_duration, up to the longest added
+	const std::vector<int> & dense() const
+	{
+		return m_dense;
+	}
 
-	*m_json_stream << ",\"hist_off\": [";
-	delim = "";
-	for (const auto & e : off_hist) {
-		*m_json_stream << delim << "{" << e.first << ": " << e.second << "}";
-		delim = ",";
+	// call f(duration, frequency) for each bin, shortest first. durations
+	// above dense_duration are the shortest of their log-spaced bin.
+	template <typename F>
+	void forEach(F f) const
+	{
+		for (size_t i = 0; i < m_dense.size(); i++) {
+			if (m_dense[i]) {
+				f(int64_t(i) * m_bin_width, m_dense[i]);
+			}
+		}
+		for (size_t i = 0; i < m_overflow.size(); i++) {
+			if (m_overflow[i]) {
+				f(overflowBinStart(i) * m_bin_width, m_overflow[i]);
+			}
+		}
 	}
-	*m_json_stream << "]\n";
 
-	*m_json_stream << ",\"hist_on\": [";
-	delim = "";
-	for (const auto & e : on_hist) {
-		*m_json_stream << delim << "{" << e.first << ": " << e.second << "}";
-		delim = ",";
+private :
+	size_t overflowBin(int64_t bin) const
+	{
+		return size_t(std::log2(double(bin) / m_dense_limit) * bins_per_octave);
 	}
-	*m_json_stream << "]\n";
 
-	*m_json_stream << ",\"off_time_peaks\": [";
-	delim = "";
-	for (const auto & e : off_time_peaks) {
-		*m_json_stream << delim << e;
-		delim = ",";
+	int64_t overflowBinStart(size_t overflow) const
+	{
+		return int64_t(std::ceil(m_dense_limit * std::exp2(double(overflow) / bins_per_octave)));
 	}
-	*m_json_stream << "]\n";
 
-	*m_json_stream << ",\"off_thresholds\": [";
-	delim = "";
-	for (const auto & e : off_thresholds) {
-		*m_json_stream << delim << e;
-		delim = ",";
+	int64_t m_bin_width = min_bin_width;
+	int64_t m_dense_limit = dense_duration / min_bin_width; // in bins
+	std::vector<int> m_dense; // up to the longest bin below m_dense_limit
+	std::vector<int> m_overflow;
+};
+
+/*
+state of a frame with 'luminance' : it must be 'margin' past 'threshold'
+to change from 'last_state'
+*/
+inline int hysteresisState(
+	double luminance, double threshold, double margin, int last_state
+)
+{
+	return luminance >= threshold + (last_state == 1 ? -margin : margin)
+		? 1 : 0;
+}
+
+/*
+signals from the state of each frame. a change of state only counts once
+the new state has lasted 'min_run' frames, and then dates from its first
+frame, so shorter glitches are merged into the signal around them.
+starts in state 0 at the first frame. durations are differences between
+the times given with the frames.
+*/
+class Debounce {
+public :
+	void setMinRun(int min_run)
+	{
+		m_min_run = min_run;
 	}
-	*m_json_stream << "]\n";
 
-	*m_json_stream << ",\"on_time_peaks\": [";
-	delim = "";
-	for (const auto & e : on_time_peaks) {
-		*m_json_stream << delim << e;
-		delim = ",";
+	// start in 'state' at 'time' instead
+	void start(int64_t time, int state)
+	{
+		m_state = state;
+		m_started = true;
+		m_start_time = time;
+	}
+
+	// state of frame 'frame_index' at 'time'. if that confirms a change of
+	// state, return true with the state and duration of the signal it ends.
+	bool update(
+		int frame_index, int64_t time, int state,
+		unsigned & ended_state, int64_t & duration
+	)
+	{
+		if (!m_started) {
+			m_started = true;
+			m_start_time = time;
+		}
+		if (state == m_state) {
+			m_pending = -1;
+			return false;
+		}
+		if (m_pending == -1) {
+			m_pending = frame_index;
+			m_pending_time = time;
+		}
+		if (frame_index - m_pending + 1 < m_min_run) {
+			return false;
+		}
+
+		ended_state = m_state;
+		duration = m_pending_time - m_start_time;
+		m_state = state;
+		m_start_time = m_pending_time;
+		m_pending = -1;
+		return true;
+	}
+
+	int state() const
+	{
+		return m_state;
+	}
+
+	// time the current state started
+	int64_t lastChange() const
+	{
+		return m_start_time;
+	}
+
+private :
+	int m_min_run = 1;
+	int m_state = 0;
+	bool m_started = false;
+	int64_t m_start_time = 0;
+	int m_pending = -1; // first frame of a possible change of state
+	int64_t m_pending_time = 0;
+};
+
+/*
+threshold half way between the recent "on" and "off" luminance levels,
+each an exponentially weighted moving average of the frames in that
+state, so it follows changes in lighting or exposure. a frame beyond
+the level of its state moves it half way at once, so the first pulse
+separates the levels quickly. O(1) per frame.
+*/
+class AdaptiveThreshold {
+public :
+	// levels closer than this are noise, not pulses and gaps
+	static const unsigned min_contrast = 16;
+
+	// 'frames' : time constant of the averages.
+	// 'hysteresis' : fraction of the contrast between the levels a frame
+	// must be past the threshold to change state.
+	void setup(double frames, double hysteresis)
+	{
+		m_alpha = 1 / std::max(frames, 1.0);
+		m_hysteresis = hysteresis;
+	}
+
+	// state of the next frame : 0 = off, 1 = on, -1 = not enough contrast yet
+	int update(unsigned luminance)
+	{
+		if (m_first) {
+			m_on = m_off = luminance;
+			m_first = false;
+		}
+
+		const double contrast = m_on - m_off;
+		const double margin = m_hysteresis * contrast / 2;
+		int state;
+		if (contrast < min_contrast) {
+			state = luminance > threshold() ? 1 : 0;
+		} else {
+			state = hysteresisState(luminance, threshold(), margin, m_state);
+		}
+
+		double & level = state ? m_on : m_off;
+		const bool beyond = state ? luminance > m_on : luminance < m_off;
+		level += (beyond ? 0.5 : m_alpha) * (luminance - level);
+
+		m_state = contrast < min_contrast ? -1 : state;
+		return m_state;
+	}
+
+	double threshold() const
+	{
+		return (m_on + m_off) / 2;
+	}
+
+	double onLevel() const
+	{
+		return m_on;
+	}
+
+	double offLevel() const
+	{
+		return m_off;
+	}
+
+private :
+	double m_alpha = 1;
+	double m_hysteresis = 0;
+	bool m_first = true;
+	double m_on = 0, m_off = 0;
+	int m_state = -1;
+};
+
+// set by SIGINT, to stop reading live input
+volatile std::sig_atomic_t interrupted = 0;
+
+extern "C" void onInterrupt(int)
+{
+	interrupted = 1;
+}
+
+// lets FFmpeg abandon blocking reads when interrupted
+int interruptCallback(void *)
+{
+	return interrupted;
+}
+
+struct QueueStats {
+	size_t capacity;
+	size_t max_depth;
+	double mean_depth; // when items are pushed
+	uint64_t full_stalls; // pushes which waited for space
+	uint64_t empty_stalls; // pops which waited for an item
+};
+
+/*
+bounded single-producer single-consumer queue, without locks.
+
+push() waits while the queue is full and pop() while it is empty, yielding
+and then sleeping. the waits are counted : many full stalls means the
+consumer is the slower stage, many empty stalls means the producer is.
+*/
+template <typename T>
+class SpscQueue {
+public :
+	explicit SpscQueue(size_t capacity)
+		: m_items(capacity + 1)
+	{
+	}
+
+	// producer : add 'item', waiting for space
+	void push(T item)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		const size_t next = (tail + 1) % m_items.size();
+		size_t head = m_head.load(std::memory_order_acquire);
+
+		if (next == head) {
+			m_full_stalls++;
+			for (unsigned n = 0; next == head; n++) {
+				wait(n);
+				head = m_head.load(std::memory_order_acquire);
+			}
+		}
+
+		const size_t depth = (next + m_items.size() - head) % m_items.size();
+		m_max_depth = std::max(m_max_depth, depth);
+		m_total_depth += depth;
+		m_pushes++;
+
+		m_items[tail] = std::move(item);
+		m_tail.store(next, std::memory_order_release);
+	}
+
+	// producer : no more items will be pushed
+	void close()
+	{
+		m_closed.store(true, std::memory_order_release);
+	}
+
+	// consumer : remove the next item, waiting for one.
+	// false once the queue is closed and empty.
+	bool pop(T & item)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+
+		if (head == m_tail.load(std::memory_order_acquire)) {
+			for (unsigned n = 0; ; n++) {
+				// closed is set after the last push, so check it first
+				const bool closed = m_closed.load(std::memory_order_acquire);
+				if (head != m_tail.load(std::memory_order_acquire)) {
+					break;
+				}
+				if (closed) {
+					return false;
+				}
+				if (n == 0) {
+					m_empty_stalls++;
+				}
+				wait(n);
+			}
+		}
+
+		item = std::move(m_items[head]);
+		m_head.store((head + 1) % m_items.size(), std::memory_order_release);
+		return true;
+	}
+
+	// only valid once producer and consumer have finished
+	QueueStats stats() const
+	{
+		QueueStats s;
+		s.capacity = m_items.size() - 1;
+		s.max_depth = m_max_depth;
+		s.mean_depth = m_pushes ? (double)m_total_depth / m_pushes : 0;
+		s.full_stalls = m_full_stalls;
+		s.empty_stalls = m_empty_stalls;
+		return s;
+	}
+
+private :
+	static void wait(unsigned n)
+	{
+		if (n < 64) {
+			std::this_thread::yield();
+		} else {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+
+	std::vector<T> m_items;
+	std::atomic<size_t> m_head { 0 }; // next item to pop
+	std::atomic<size_t> m_tail { 0 }; // next slot to push
+	std::atomic<bool> m_closed { false };
+
+	// written by producer
+	size_t m_max_depth = 0;
+	uint64_t m_total_depth = 0;
+	uint64_t m_pushes = 0;
+	uint64_t m_full_stalls = 0;
+
+	// written by consumer
+	uint64_t m_empty_stalls = 0;
+};
+
+/*
+runs jobs 0 to count - 1 on a number of threads. the jobs are dealt out
+to a queue per thread, which takes them from the front of its own queue,
+and when that's empty steals from the back of another's, so a few long
+jobs don't leave the other threads idle.
+*/
+class WorkStealingPool {
+public :
+	explicit WorkStealingPool(int threads)
+	{
+		for (int i = 0; i < std::max(threads, 1); i++) {
+			m_queues.emplace_back(new Queue);
+		}
+	}
+
+	// call job(index) for each job, returns when they've all finished
+	template <typename F>
+	void run(size_t count, F job)
+	{
+		for (size_t i = 0; i < count; i++) {
+			m_queues[i % m_queues.size()]->jobs.push_back(i);
+		}
+
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < m_queues.size(); i++) {
+			threads.emplace_back([this, i, &job]() {
+				size_t index;
+				while (take(i, index)) {
+					job(index);
+				}
+			});
+		}
+		for (auto & thread : threads) {
+			thread.join();
+		}
+	}
+
+private :
+	struct Queue {
+		std::mutex mutex;
+		std::deque<size_t> jobs;
+	};
+
+	// next job for thread 'thread', false when there are none left
+	bool take(size_t thread, size_t & index)
+	{
+		{
+			Queue & own = *m_queues[thread];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty()) {
+				index = own.jobs.front();
+				own.jobs.pop_front();
+				return true;
+			}
+		}
+		for (size_t i = 1; i < m_queues.size(); i++) {
+			Queue & other = *m_queues[(thread + i) % m_queues.size()];
+			std::lock_guard<std::mutex> lock(other.mutex);
+			if (!other.jobs.empty()) {
+				index = other.jobs.back();
+				other.jobs.pop_back();
+				return true;
+			}
+		}
+		// jobs are only added before the threads start, so none will appear
+		return false;
+	}
+
+	std::vector<std::unique_ptr<Queue>> m_queues;
+};
+
+// register formats, codecs and devices once, before any thread uses them
+void initFFmpeg()
+{
+	static std::once_flag once;
+	std::call_once(once, []() {
+		av_register_all();
+		avdevice_register_all();
+		avformat_network_init();
+	});
+}
+
+// one 8-bit colour component (eg. blue, or luma) of a picture
+struct Component {
+	const uint8_t *data; // sample of pixel (0,0)
+	int linesize; // bytes between rows
+	int step; // bytes between horizontally adjacent samples
+	int log2_w, log2_h; // subsampling relative to the picture
+};
+
+/*
+return index of 'channel' (one of "rgbyuv") in the components of 'desc',
+or -1 if it isn't a component of the format that can be read directly as
+8-bit samples.
+*/
+int findComponent(const AVPixFmtDescriptor *desc, char channel)
+{
+	static const std::string channels = "rgbyuv";
+	const size_t n = channels.find(channel);
+
+	if (desc == NULL || n == std::string::npos) {
+		return -1;
+	}
+	if (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM
+		| AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BAYER)
+	) {
+		return -1;
+	}
+
+	// descriptors list R,G,B or Y,U,V in that order, whatever the layout
+	const bool rgb = n < 3;
+	const int index = n % 3;
+	if (rgb != ((desc->flags & AV_PIX_FMT_FLAG_RGB) != 0)) {
+		return -1;
+	}
+	// gray formats have luma (and maybe alpha) only
+	if (desc->nb_components < (index ? 3 : 1)) {
+		return -1;
+	}
+	if (desc->comp[index].depth != 8 || desc->comp[index].shift != 0) {
+		return -1;
+	}
+	return index;
+}
+
+// subsampling of component 'index' of 'desc' relative to the picture
+void componentSubsampling(
+	const AVPixFmtDescriptor *desc, int index, int & log2_w, int & log2_h
+)
+{
+	const bool chroma = index == 1 || index == 2;
+	log2_w = chroma ? desc->log2_chroma_w : 0;
+	log2_h = chroma ? desc->log2_chroma_h : 0;
+}
+
+// component 'index' of a picture with format 'desc'
+Component getComponent(
+	const uint8_t * const data[4],
+	const int linesize[4],
+	const AVPixFmtDescriptor *desc,
+	int index
+)
+{
+	const AVComponentDescriptor & comp = desc->comp[index];
+	Component c;
+
+	c.data = data[comp.plane] + comp.offset;
+	c.linesize = linesize[comp.plane];
+	c.step = comp.step;
+	componentSubsampling(desc, index, c.log2_w, c.log2_h);
+	return c;
+}
+
+// sum of 'n' 8-bit samples, 'step' bytes apart, starting at 'p'
+typedef uint64_t (*SumSamplesFunction)(const uint8_t *p, int n, int step);
+
+uint64_t sumSamplesScalar(const uint8_t *p, int n, int step)
+{
+	uint64_t s = 0;
+	for (int i = 0; i < n; i++) {
+		s += p[i * step];
+	}
+	return s;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+masks to select samples with a step of 1-4 bytes from 'step' consecutive
+vectors of W bytes : masks[step - 1][vector][byte]
+*/
+template <int W>
+struct StepMasks {
+	alignas(32) uint8_t masks[4][4][W];
+
+	StepMasks()
+	{
+		for (int step = 1; step <= 4; step++) {
+			for (int k = 0; k < 4; k++) {
+				for (int j = 0; j < W; j++) {
+					masks[step - 1][k][j] = (k * W + j) % step ? 0 : 0xff;
+				}
+			}
+		}
+	}
+};
+
+__attribute__((target("sse2")))
+uint64_t sumSamplesSSE2(const uint8_t *p, int n, int step)
+{
+	static const StepMasks<16> m;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i s = zero;
+	int i = 0;
+
+	if (step == 1) {
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+			s = _mm_add_epi64(s, _mm_sad_epu8(v, zero));
+		}
+	} else if (step <= 4) {
+		// each block of 16 samples is 'step' vectors, masked to the samples.
+		// the sample after the block must exist, so that reading up to it
+		// doesn't go past the end of the row.
+		for (; i + 16 < n; i += 16) {
+			const uint8_t *b = p + i * step;
+			for (int k = 0; k < step; k++) {
+				__m128i v = _mm_loadu_si128((const __m128i *)(b + k * 16));
+				v = _mm_and_si128(v,
+					_mm_load_si128((const __m128i *)m.masks[step - 1][k]));
+				s = _mm_add_epi64(s, _mm_sad_epu8(v, zero));
+			}
+		}
+	}
+
+	alignas(16) uint64_t lanes[2];
+	_mm_store_si128((__m128i *)lanes, s);
+	return lanes[0] + lanes[1] + sumSamplesScalar(p + i * step, n - i, step);
+}
+
+__attribute__((target("avx2")))
+uint64_t sumSamplesAVX2(const uint8_t *p, int n, int step)
+{
+	static const StepMasks<32> m;
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i s = zero;
+	int i = 0;
+
+	if (step == 1) {
+		for (; i + 32 <= n; i += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+			s = _mm256_add_epi64(s, _mm256_sad_epu8(v, zero));
+		}
+	} else if (step <= 4) {
+		// as sumSamplesSSE2
+		for (; i + 32 < n; i += 32) {
+			const uint8_t *b = p + i * step;
+			for (int k = 0; k < step; k++) {
+				__m256i v = _mm256_loadu_si256((const __m256i *)(b + k * 32));
+				v = _mm256_and_si256(v,
+					_mm256_load_si256((const __m256i *)m.masks[step - 1][k]));
+				s = _mm256_add_epi64(s, _mm256_sad_epu8(v, zero));
+			}
+		}
+	}
+
+	alignas(32) uint64_t lanes[4];
+	_mm256_store_si256((__m256i *)lanes, s);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3]
+		+ sumSamplesSSE2(p + i * step, n - i, step);
+}
+
+#endif
+
+// choose the fastest implementation the CPU supports
+SumSamplesFunction selectSumSamples()
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return sumSamplesAVX2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return sumSamplesSSE2;
+	}
+#endif
+	return sumSamplesScalar;
+}
+
+uint64_t sumSamples(const uint8_t *p, int n, int step)
+{
+	static const SumSamplesFunction f = selectSumSamples();
+	return f(p, n, step);
+}
+
+// add 'n' 8-bit samples, 'step' bytes apart, starting at 'p', to 'sums'
+typedef void (*AddSamplesFunction)(uint16_t *sums, const uint8_t *p, int n, int step);
+
+void addSamplesScalar(uint16_t *sums, const uint8_t *p, int n, int step)
+{
+	for (int i = 0; i < n; i++) {
+		sums[i] += p[i * step];
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+void addSamplesSSE2(uint16_t *sums, const uint8_t *p, int n, int step)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+
+	if (step == 1) {
+		for (; i + 16 <= n; i += 16) {
+			const __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+			__m128i *s = (__m128i *)(sums + i);
+			_mm_storeu_si128(s, _mm_add_epi16(_mm_loadu_si128(s),
+				_mm_unpacklo_epi8(v, zero)));
+			_mm_storeu_si128(s + 1, _mm_add_epi16(_mm_loadu_si128(s + 1),
+				_mm_unpackhi_epi8(v, zero)));
+		}
+	}
+	addSamplesScalar(sums + i, p + i * step, n - i, step);
+}
+
+#endif
+
+AddSamplesFunction selectAddSamples()
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		return addSamplesSSE2;
+	}
+#endif
+	return addSamplesScalar;
+}
+
+void addSamples(uint16_t *sums, const uint8_t *p, int n, int step)
+{
+	static const AddSamplesFunction f = selectAddSamples();
+	f(sums, p, n, step);
+}
+
+// can a frame of this pixel format be cropped by offsetting plane pointers?
+bool canCrop(const AVPixFmtDescriptor *desc)
+{
+	if (desc == NULL) {
+		return false;
+	}
+	if (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM
+		| AV_PIX_FMT_FLAG_HWACCEL)
+	) {
+		return false;
+	}
+	// packed formats with subsampled chroma (eg. YUYV) share bytes between
+	// neighbouring pixels
+	if (!(desc->flags & AV_PIX_FMT_FLAG_PLANAR) && desc->log2_chroma_w) {
+		return false;
+	}
+	return true;
+}
+
+/*
+set 'data' to point at pixel (x,y) of each plane of 'frame'.
+x and y must be multiples of the chroma subsampling of the format.
+*/
+void cropPlanes(
+	const AVFrame *frame,
+	const AVPixFmtDescriptor *desc,
+	int x, int y,
+	const uint8_t *data[4]
+)
+{
+	int max_pixsteps[4];
+	av_image_fill_max_pixsteps(max_pixsteps, NULL, desc);
+
+	for (int i = 0; i < 4; i++) {
+		data[i] = frame->data[i];
+		if (data[i] == NULL) {
+			continue;
+		}
+		if (i == 1 || i == 2) {
+			if (desc->flags & AV_PIX_FMT_FLAG_PSEUDOPAL) {
+				// palette, not pixels
+				continue;
+			}
+			data[i] += (y >> desc->log2_chroma_h) * frame->linesize[i];
+			data[i] += (x >> desc->log2_chroma_w) * max_pixsteps[i];
+		} else {
+			data[i] += y * frame->linesize[i];
+			data[i] += x * max_pixsteps[i];
+		}
+	}
+}
+
+/*
+grid of cells over part of a picture, measured by block sums : the rows of
+each row of cells are added into one row of column sums, reading only every
+few rows (enough for about 8 from each row of cells), and each cell is the
+sum of its part of that. so a large frame is scanned once, downscaled,
+however many cells there are.
+*/
+class CellGrid {
+public :
+	// 'columns' x 'rows' cells over (x0,y0)-(x1,y1), in pixels
+	void setup(int x0, int y0, int x1, int y1, int columns, int rows)
+	{
+		m_x.resize(columns + 1);
+		m_y.resize(rows + 1);
+		for (int i = 0; i <= columns; i++) {
+			m_x[i] = x0 + (x1 - x0) * i / columns;
+		}
+		for (int i = 0; i <= rows; i++) {
+			m_y[i] = y0 + (y1 - y0) * i / rows;
+		}
+		m_row_step = std::max((y1 - y0) / rows / 8, 1);
+	}
+
+	size_t size() const
+	{
+		return columns() * rows();
+	}
+
+	int columns() const
+	{
+		return m_x.size() - 1;
+	}
+
+	int rows() const
+	{
+		return m_y.size() - 1;
+	}
+
+	// cell i, in pixels, x1 and y1 exclusive
+	void cell(size_t i, int & x0, int & y0, int & x1, int & y1) const
+	{
+		const int column = i % columns(), row = i / columns();
+		x0 = m_x[column];
+		y0 = m_y[row];
+		x1 = m_x[column + 1];
+		y1 = m_y[row + 1];
+	}
+
+	// average of 'component' in each cell, a row of cells after another
+	void measure(const Component & component, std::vector<unsigned> & averages)
+	{
+		// cell edges in samples of the component, from the left of the grid
+		m_edges.resize(m_x.size());
+		for (size_t i = 0; i < m_x.size(); i++) {
+			m_edges[i] = (m_x[i] >> component.log2_w) - (m_x[0] >> component.log2_w);
+		}
+		// a cell narrower than a sample reads the one it's in
+		const int width = std::max(m_edges.back(), 1);
+		const uint8_t *left = component.data
+			+ (m_x[0] >> component.log2_w) * component.step;
+
+		averages.resize(size());
+		m_column_sums.resize(width);
+		for (int row = 0; row < rows(); row++) {
+			const int y0 = m_y[row] >> component.log2_h;
+			const int y1 = std::max(m_y[row + 1] >> component.log2_h, y0 + 1);
+			std::fill(m_column_sums.begin(), m_column_sums.end(), 0);
+			const uint16_t *sums = m_column_sums.data();
+			int rows_read = 0;
+			// at most about 16 rows are read, so the sums fit 16 bits
+			for (int y = y0; y < y1; y += m_row_step, rows_read++) {
+				addSamples(m_column_sums.data(),
+					left + y * component.linesize, width, component.step);
+			}
+			for (int column = 0; column < columns(); column++) {
+				const int x0 = std::min(m_edges[column], width - 1);
+				const int x1 = std::max(m_edges[column + 1], x0 + 1);
+				unsigned total = 0;
+				for (int x = x0; x < x1; x++) {
+					total += sums[x];
+				}
+				averages[row * columns() + column] = total
+					/ (rows_read * (x1 - x0));
+			}
+		}
+	}
+
+private :
+	std::vector<int> m_x, m_y; // edges of the columns and rows of cells
+	int m_row_step = 1;
+	std::vector<int> m_edges; // of the columns, in samples of the component
+	std::vector<uint16_t> m_column_sums; // of the rows read of a row of cells
+};
+
+/*
+statistics of the luminance of an area over the frames, kept as each frame
+is added, to tell a lamp sending morse from noise, flicker or movement :
+how cleanly it switches between two levels, and how many pulses it sends,
+of how many lengths.
+*/
+class BlinkStats {
+public :
+	// 'frames' : time constant of the threshold between on and off
+	void setup(double frames)
+	{
+		m_threshold.setup(frames, 0);
+	}
+
+	void add(unsigned luminance)
+	{
+		const int state = m_threshold.update(luminance);
+
+		m_frames++;
+		m_sum += luminance;
+		m_sum_squares += luminance * luminance;
+		if (state == 1) {
+			m_on_frames++;
+			m_on_sum += luminance;
+			m_run = m_state == 1 ? m_run + 1 : 1;
+		} else if (m_state == 1) {
+			m_pulses++;
+			m_shortest = std::min(m_shortest, m_run);
+			m_longest = std::max(m_longest, m_run);
+		}
+		m_state = state;
+	}
+
+	// pulses ended so far
+	unsigned pulses() const
+	{
+		return m_pulses;
+	}
+
+	// between the on and off levels, 0 if they're too close to tell apart
+	double contrast() const
+	{
+		return m_state == -1 ? 0
+			: m_threshold.onLevel() - m_threshold.offLevel();
+	}
+
+	// fraction of the variance explained by the frames being on or off (0-1)
+	double separability() const
+	{
+		const uint64_t off_frames = m_frames - m_on_frames;
+		if (m_on_frames == 0 || off_frames == 0) {
+			return 0;
+		}
+		const double mean = (double)m_sum / m_frames;
+		const double variance = (double)m_sum_squares / m_frames - mean * mean;
+		const double on_mean = (double)m_on_sum / m_on_frames;
+		const double off_mean = (double)(m_sum - m_on_sum) / off_frames;
+		const double p = (double)m_on_frames / m_frames;
+		return variance > 0 ? std::min(p * (1 - p)
+			* (on_mean - off_mean) * (on_mean - off_mean) / variance, 1.0) : 0;
+	}
+
+	/*
+	how much it looks like a lamp sending morse, 0 if not at all : more
+	pulses, more contrast and a cleaner switch between levels score higher,
+	and pulses of only one length (eg. a flashing light) score half.
+	*/
+	double score() const
+	{
+		if (m_pulses < 2) {
+			return 0;
+		}
+		const double s = separability();
+		return m_pulses * contrast() * s * s
+			* (m_longest >= 2 * m_shortest ? 1 : 0.5);
+	}
+
+private :
+	AdaptiveThreshold m_threshold;
+	int m_state = -1;
+	uint64_t m_frames = 0, m_sum = 0, m_sum_squares = 0;
+	uint64_t m_on_frames = 0, m_on_sum = 0;
+	int m_run = 0; // frames of the current pulse
+	unsigned m_pulses = 0;
+	int m_shortest = std::numeric_limits<int>::max(), m_longest = 0;
+};
+
+/*
+follows an area of a picture as it moves from frame to frame. each frame,
+a window around the area is reduced to blocks of about an eighth of the
+area (with CellGrid), and the area is centred on the bright blob in it,
+or if there isn't one (eg. the lamp is off), moved by the displacement
+which best matches the blocks around it when it last moved (block
+matching, by least sum of absolute differences). the area can move up to
+'search' blocks a frame.
+*/
+class AreaTracker {
+public :
+	static const int search = 4;
+
+	// follow (x0,y0)-(x1,y1) in a picture of 'width' x 'height' pixels,
+	// measured in a component subsampled by 'log2_w' and 'log2_h'
+	void setup(int x0, int y0, int x1, int y1, int width, int height,
+		int log2_w, int log2_h)
+	{
+		m_x = x0;
+		m_y = y0;
+		m_area_width = x1 - x0;
+		m_area_height = y1 - y0;
+		m_width = width;
+		m_height = height;
+		// at least a sample of the component each way
+		m_block = std::max(std::min(m_area_width, m_area_height) / 8,
+			1 << std::max(log2_w, log2_h));
+	}
+
+	// find the area in the next frame. returns true if it moved.
+	bool update(const Component & component)
+	{
+		const int x = m_x, y = m_y;
+
+		measure(component, m_blocks);
+		int blob_x, blob_y;
+		if (findBlob(blob_x, blob_y)) {
+			// not for less than half a block, which may be noise
+			const int dx = blob_x - (m_x + m_area_width / 2);
+			const int dy = blob_y - (m_y + m_area_height / 2);
+			if (2 * std::max(std::abs(dx), std::abs(dy)) >= m_block) {
+				moveTo(m_x + dx, m_y + dy);
+			}
+		} else if (!m_previous.empty() && !m_previous_lit) {
+			int dx, dy;
+			match(dx, dy);
+			moveTo(m_x + dx * m_block, m_y + dy * m_block);
+		}
+
+		// blocks around the area where it moved to, to match in the next
+		// frames. kept while it stays still, so movement of less than a
+		// block a frame adds up until it's matched, unless the lamp was on,
+		// as the light around it would be matched.
+		if (m_x != x || m_y != y) {
+			measure(component, m_previous);
+			m_previous_lit = m_lamp_on;
+			m_moves++;
+		} else if (m_previous.empty() || m_previous_lit) {
+			m_previous.swap(m_blocks);
+			m_previous_lit = m_lamp_on;
+		}
+		return m_x != x || m_y != y;
+	}
+
+	// area now, in pixels, x1 and y1 exclusive
+	void area(int & x0, int & y0, int & x1, int & y1) const
+	{
+		x0 = m_x;
+		y0 = m_y;
+		x1 = m_x + m_area_width;
+		y1 = m_y + m_area_height;
+	}
+
+	// frames the area moved in
+	unsigned moves() const
+	{
+		return m_moves;
+	}
+
+private :
+	// blocks of the window around the area, row by row
+	void measure(const Component & component, std::vector<unsigned> & blocks)
+	{
+		const int margin = search * m_block;
+		m_window_x = std::max(m_x - margin, 0);
+		m_window_y = std::max(m_y - margin, 0);
+		const int x1 = std::min(m_x + m_area_width + margin, m_width);
+		const int y1 = std::min(m_y + m_area_height + margin, m_height);
+		m_columns = (x1 - m_window_x) / m_block;
+		m_rows = (y1 - m_window_y) / m_block;
+		m_grid.setup(m_window_x, m_window_y,
+			m_window_x + m_columns * m_block, m_window_y + m_rows * m_block,
+			m_columns, m_rows);
+		m_grid.measure(component, blocks);
+	}
+
+	/*
+	centre of the blob around the brightest block of the area, of the
+	blocks of the window at least half way between its mean and the
+	brightest, in pixels. false unless the lamp is on : it's taken to
+	switch on when the brightest block of the area is brighter than in the
+	previous frame by at least the minimum contrast, so bright parts of the
+	scene aren't mistaken for it, and to stay on while it's at least half
+	way from the mean to its brightest.
+	*/
+	bool findBlob(int & x, int & y)
+	{
+		int area_column, area_row, area_end_column, area_end_row;
+		areaBlocks(area_column, area_row, area_end_column, area_end_row);
+		size_t brightest = area_row * m_columns + area_column;
+		for (int r = area_row; r < area_end_row; r++) {
+			for (int c = area_column; c < area_end_column; c++) {
+				if (m_blocks[r * m_columns + c] > m_blocks[brightest]) {
+					brightest = r * m_columns + c;
+				}
+			}
+		}
+
+		double mean = 0;
+		for (unsigned b : m_blocks) {
+			mean += b;
+		}
+		mean /= m_blocks.size();
+		const double contrast = m_blocks[brightest] - mean;
+		const double min_contrast = AdaptiveThreshold::min_contrast;
+		if (!m_lamp_on) {
+			m_lamp_on = m_brightest >= 0 && contrast >= min_contrast
+				&& m_blocks[brightest] >= m_brightest + min_contrast;
+			m_peak = m_blocks[brightest];
+		} else {
+			m_lamp_on = contrast >= std::max(min_contrast, (m_peak - mean) / 2);
+			m_peak = std::max<double>(m_peak, m_blocks[brightest]);
+		}
+		m_brightest = *std::max_element(m_blocks.begin(), m_blocks.end());
+		if (!m_lamp_on) {
+			return false;
+		}
+		const double threshold = (m_blocks[brightest] + mean) / 2;
+
+		std::vector<bool> seen(m_blocks.size());
+		std::deque<size_t> blob { brightest };
+		seen[brightest] = true;
+		double total = 0, sum_x = 0, sum_y = 0;
+		while (!blob.empty()) {
+			const size_t i = blob.front();
+			blob.pop_front();
+			const double weight = m_blocks[i] - threshold;
+			const int column = i % m_columns, row = i / m_columns;
+			total += weight;
+			sum_x += weight * (column + 0.5);
+			sum_y += weight * (row + 0.5);
+
+			const int neighbours[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+			for (const auto & n : neighbours) {
+				const int c = column + n[0], r = row + n[1];
+				const size_t j = r * m_columns + c;
+				if (c >= 0 && c < m_columns && r >= 0 && r < m_rows
+					&& !seen[j] && m_blocks[j] >= threshold
+				) {
+					seen[j] = true;
+					blob.push_back(j);
+				}
+			}
+		}
+		x = m_window_x + (int)(sum_x / total * m_block);
+		y = m_window_y + (int)(sum_y / total * m_block);
+		return true;
+	}
+
+	// blocks of the window covered by any of the area, the ends exclusive
+	void areaBlocks(int & column, int & row, int & end_column, int & end_row) const
+	{
+		column = (m_x - m_window_x) / m_block;
+		row = (m_y - m_window_y) / m_block;
+		end_column = std::min((m_x + m_area_width - m_window_x + m_block - 1) / m_block, m_columns);
+		end_row = std::min((m_y + m_area_height - m_window_y + m_block - 1) / m_block, m_rows);
+	}
+
+	/*
+	displacement in blocks of the window when the area last moved which
+	best matches this one, comparing the blocks around the area only, so the
+	lamp switching on or off doesn't look like movement. no movement unless
+	another matches clearly better, so a featureless or noisy window keeps
+	still.
+	*/
+	void match(int & dx, int & dy) const
+	{
+		int area_column, area_row, area_end_column, area_end_row;
+		areaBlocks(area_column, area_row, area_end_column, area_end_row);
+
+		// the previous window was measured at the area's current position
+		uint64_t best = std::numeric_limits<uint64_t>::max(), still = 0;
+		dx = dy = 0;
+		for (int r = 0; r <= 2 * search; r++) {
+			for (int s = 0; s <= 2 * search; s++) {
+				// try the nearest displacements first
+				const int x = (s + 1) / 2 * (s % 2 ? 1 : -1);
+				const int y = (r + 1) / 2 * (r % 2 ? 1 : -1);
+				uint64_t sad = 0, count = 0;
+				for (int row = std::max(-y, 0); row < std::min(m_rows - y, m_rows); row++) {
+					for (int column = std::max(-x, 0); column < std::min(m_columns - x, m_columns); column++) {
+						const auto inArea = [&](int r, int c) {
+							return r >= area_row && r < area_end_row
+								&& c >= area_column && c < area_end_column;
+						};
+						if (inArea(row, column) || inArea(row + y, column + x)) {
+							continue;
+						}
+						const int a = m_previous[row * m_columns + column];
+						const int b = m_blocks[(row + y) * m_columns + column + x];
+						sad += std::abs(a - b);
+						count++;
+					}
+				}
+				// per block, as the windows overlap less the further they move,
+				// and more the further it is, as a repeating pattern matches
+				// further away too
+				const int distance = std::max(std::abs(x), std::abs(y));
+				const uint64_t cost = count
+					? sad * 1024 / count * (2 * search + distance) / (2 * search)
+					: best;
+				if (x == 0 && y == 0) {
+					still = cost;
+				}
+				if (cost < best) {
+					best = cost;
+					dx = x;
+					dy = y;
+				}
+			}
+		}
+		// within a fifth of the cost of not moving, or 2 levels a block
+		if (5 * best >= 4 * still || best + 2 * 1024 > still) {
+			dx = dy = 0;
+		}
+	}
+
+	// move the area, keeping it in the picture
+	void moveTo(int x, int y)
+	{
+		m_x = std::min(std::max(x, 0), m_width - m_area_width);
+		m_y = std::min(std::max(y, 0), m_height - m_area_height);
+	}
+
+	int m_x = 0, m_y = 0; // top-left of the area
+	int m_area_width = 0, m_area_height = 0;
+	int m_width = 0, m_height = 0; // of the picture
+	int m_block = 1; // pixels square
+
+	// window around the area, in blocks
+	CellGrid m_grid;
+	int m_window_x = 0, m_window_y = 0, m_columns = 0, m_rows = 0;
+	std::vector<unsigned> m_blocks, m_previous;
+	bool m_previous_lit = false; // lamp was on when m_previous was measured
+	bool m_lamp_on = false;
+	int m_brightest = -1; // block of the window in the previous frame
+	double m_peak = 0; // brightest block of the area since the lamp switched on
+	unsigned m_moves = 0;
+};
+
+}
+
+using namespace Util;
+
+// --interpolate names, in Interpolation order
+constexpr const char *interpolation_methods[] = { "none", "linear", "parabolic" };
+
+// --threshold names, in ThresholdMethod order
+constexpr const char *threshold_methods[] = { "mean", "adaptive", "otsu", "kmeans" };
+
+class VideoMorseDecode {
+public :
+	enum ThresholdMethod {
+		THRESHOLD_MEAN, // of all frames
+		THRESHOLD_ADAPTIVE, // AdaptiveThreshold, as frames are read
+		THRESHOLD_OTSU, // maximum variance between on and off frames
+		THRESHOLD_KMEANS // half way between two luminance centroids
+	};
+
+	// of edges between frames
+	enum Interpolation {
+		INTERPOLATE_NONE,
+		INTERPOLATE_LINEAR,
+		INTERPOLATE_PARABOLIC
+	};
+
+	// area of a frame, as fractions of its width and height
+	struct Bounds {
+		double x0, y0, x1, y1;
+	};
+
+	struct Options {
+		double x0, y0, x1, y1;
+		std::vector<Bounds> areas; // more areas to examine, from --area
+		int locate = 0; // lamps to search the area for, 0 = examine it all
+		int locate_cells = 32; // columns of the grid searched
+		bool track = false; // follow the areas as they move
+		int lowres = 0; // decode at 1/2^lowres size, where the codec can
+		bool fast_decode = false; // skip the loop filter etc.
+		bool compare_full = false; // decode again at full quality, and compare
+		int start_frame, end_frame;
+		std::string json_file_name;
+		std::string video_file_name;
+		bool full_frame = false; // convert whole frame, not just the area
+		bool convert = false; // convert even when component can be read
+		char channel = 'b'; // blue works best for the BF4 lantern
+		int threads = 0; // decoding threads, 0 = one per core
+		bool seek = true; // seek to start_frame rather than decode up to it
+		bool stream = false; // print each letter as soon as it's received
+		bool morse_text = true; // report dots and dashes as text
+		int alphabet = 0; // index into morse_tables
+		bool prosigns = false; // prefer procedural signals to characters
+		bool live = false; // treat input as live even if it's not detected
+		std::string input_format; // FFmpeg input format, if not detected
+		int history = -1; // frames kept for analysis, 0 = all, -1 = default
+		std::string batch_file_name; // manifest of videos to decode, if any
+		int jobs = 0; // videos decoded at once in a batch, 0 = one per core
+		ThresholdMethod threshold = THRESHOLD_MEAN;
+		int adapt_frames = 30; // adaptive threshold time constant
+		double hysteresis = 0; // fraction of contrast between on and off
+		int debounce = 1; // frames a change of state must last
+		Interpolation interpolate = INTERPOLATE_NONE;
+		int histogram_bin = 0; // in microseconds, 0 = default
+		int smooth_window = 3; // duration histogram smoothing, taps either side
+		double smooth_sigma = 0.7071; // and its standard deviation in taps
+	};
+
+	// area of a frame in pixels, x1 and y1 are exclusive
+	struct Rect {
+		int x0, y0, x1, y1;
+	};
+
+	// store pulse or break signal duration
+	struct Signal {
+		unsigned state; // 0 = break, 1 = pulse
+		int64_t duration; // in microseconds
+	};
+
+	// decoded frame passed between pipeline stages
+	struct DecodedFrame {
+		AVFrame *frame;
+		int frame_index;
+	};
+
+	// average luminance of the area in one frame
+	struct Sample {
+		int frame_index;
+		int64_t timestamp; // best effort, in stream time base
+		unsigned luminance;
+		std::vector<unsigned> areas; // luminance of each --area
+	};
+
+	// area found by --locate : cells of the grid next to each other which
+	// blink together, and the one which looks most like a lamp
+	struct Candidate {
+		Bounds bounds;
+		std::vector<size_t> cells;
+		size_t best;
+	};
+
+	// meaning of a signal
+	enum Element {
+		DOT, DASH, ELEMENT_GAP, LETTER_GAP, WORD_GAP
+	};
+
+	VideoMorseDecode();
+
+	void processFrame(const Sample & sample);
+	void adaptiveFrame(int frame_index, int64_t time, int state);
+
+	bool parseOptions(int argc, char *argv[]);
+	bool run();
+	bool runBatch();
+
+	// for a batch job : use 'options', and write the report to 'json'
+	void setOptions(const Options & options, std::ostream & json);
+
+	const Options & options() const
+	{
+		return m_options;
+	}
+
+	// why run() failed
+	const std::string & error() const
+	{
+		return m_error;
+	}
+
+private :
+	void setup();
+	bool fail(const char *error);
+	bool openVideo();
+	bool setupArea();
+	void setupCrop();
+	void setupConverter();
+	void setupWindow();
+	bool setupGrid();
+	void setupTrackers();
+	void setupAnalysis(const AVRational & frame_rate, const AVRational & time_base);
+	void setupTracks(const AVRational & time_base);
+	void closeVideo();
+
+	// pipeline stages, each runs on its own thread
+	void demuxStage(SpscQueue<AVPacket *> & packets);
+	void decodeStage(
+		SpscQueue<AVPacket *> & packets,
+		SpscQueue<DecodedFrame> & frames
+	);
+	void extractStage(
+		SpscQueue<DecodedFrame> & frames,
+		SpscQueue<Sample> & samples
+	);
+
+	bool frameWanted(int frame_index) const;
+	Component measuredComponent(const AVFrame *frame);
+	void measureAreas(const AVFrame *frame, std::vector<unsigned> & luminance);
+	bool trackAreas(const Component & component);
+	static void averageAreas(const Component & component,
+		const std::vector<Rect> & areas, std::vector<unsigned> & averages);
+	void writeQueueStats(const char *name, const QueueStats & stats);
+
+	// streaming decode, while frames are read
+	void streamFrame(
+		const Sample & sample, int adaptive_state, double adaptive_threshold);
+	int64_t edgeTime(size_t i, double threshold) const;
+	void streamSignal(const Signal & signal);
+	void streamElement(const Signal & signal);
+	void streamGap(int64_t duration);
+	void streamFinish();
+
+	// --locate
+	void scanFrame(const Sample & sample);
+	void locateAreas();
+	double cellCorrelation(size_t a, size_t b) const;
+	void replayCandidates();
+	void writeCandidates();
+	void writeTracking();
+	void compareFull(double frames_per_second);
+
+	void analyse();
+	void calculateHistogram();
+	void calculateThreshold();
+	void processStateChanges();
+	void processSignals();
+	Element classifySignal(const Signal & signal) const;
+	const char *decodeSymbol(const MorseCode & code) const;
+	std::string decodeSignals();
+	std::string morseText() const;
+
+	// command-line options
+	Options m_options;
+
+	// average luminance of frame -> number of frames
+	std::vector<unsigned> m_frame_luminance_histogram;
+
+	// stream to write JSON report
+	std::ostream * m_json_stream;
+	std::ofstream m_json_file;
+	std::string m_error;
+
+	// FFmpeg stuff
+	bool m_live = false; // pipe, network stream or device
+	AVFormatContext *m_format_context = NULL;
+	AVCodecContext *m_codec_context = NULL;
+	int m_video_stream = -1;
+	unsigned m_frames_decoded = 0;
+
+	int m_decode_threads = 0;
+	int m_lowres = 0; // decoding at 1/2^m_lowres size
+
+	// index of next frame from decoder, found from its timestamp after seeking
+	int m_next_frame_index = 0;
+	bool m_seeked = false;
+	AVRational m_frame_rate;
+	int64_t m_stream_start_time = 0;
+
+	// set by decode stage once end_frame has passed
+	std::atomic<bool> m_stop { false };
+
+	// areas to examine, the first from the command line and then each
+	// --area, and how to read them from decoded frames
+	std::vector<Rect> m_areas;
+	int m_frame_width = 0, m_frame_height = 0; // pixels of decoded frames
+	const AVPixFmtDescriptor *m_desc = NULL;
+	int m_component_index = -1;
+
+	// conversion of the part of the frame containing the areas ('crop'),
+	// when the component can't be read from the decoded frame directly
+	bool m_convert = false;
+	bool m_crop_to_areas = false; // otherwise the whole frame
+	Rect m_crop;
+	std::vector<Rect> m_crop_areas; // relative to the crop
+	AVPixelFormat m_convert_pix_fmt = AV_PIX_FMT_NONE;
+	const AVPixFmtDescriptor *m_convert_desc = NULL;
+	struct SwsContext *m_sws_ctx = NULL;
+	AVFrame *m_frame_converted = NULL;
+	uint8_t *m_buffer = NULL;
+
+	// analysis of each --area, fed from the frames decoded here
+	std::vector<std::unique_ptr<VideoMorseDecode>> m_tracks;
+
+	// --locate : a grid of cells over the area, how much each looks like a
+	// lamp, and the luminance of every cell in each frame, to replay the
+	// frames of the areas found
+	CellGrid m_grid;
+	std::vector<Bounds> m_cell_bounds;
+	std::vector<BlinkStats> m_cell_stats;
+	RingBuffer<Sample> m_scanned_frames; // without the luminance
+	RingBuffer<uint8_t> m_cell_luminance; // each cell of each frame
+	std::vector<Candidate> m_candidates; // most likely first
+
+	// --track : follows each area, in the extract stage, in the luma of
+	// the decoded frame (m_track_index), or if it has none, in the
+	// component measured
+	std::vector<AreaTracker> m_trackers;
+	int m_track_index = -1;
+
+	// average luminance from selected area of each frame
+	FrameStore m_frames;
+	std::deque<Signal> m_signals;
+	int64_t m_signals_duration = 0; // total
+
+	// adaptive threshold : signals are found as frames are read
+	AdaptiveThreshold m_adaptive;
+	Debounce m_adaptive_debounce;
+
+	int m_mean_luminance;
+	int m_threshold; // frames at least this bright are on
+	double m_contrast; // between mean on and off luminance at m_threshold
+
+	// signal duration thresholds, from processSignals()
+	std::vector<int64_t> m_off_thresholds; // letter gap, word gap
+	std::vector<int64_t> m_on_thresholds; // dash
+
+	// width of duration histogram bins, in microseconds
+	int64_t m_histogram_bin = 0;
+
+	// applied to duration histograms before finding their peaks
+	std::vector<double> m_smoothing_kernel;
+
+	// streaming decode : running threshold and state
+	uint64_t m_stream_luminance_total = 0;
+	unsigned m_stream_frames = 0;
+	unsigned m_stream_min_luminance = 255, m_stream_max_luminance = 0;
+	int m_stream_state = -1; // -1 until there's enough contrast
+	int m_stream_raw_state = 0; // before debouncing
+	int64_t m_stream_last_change = -1; // time, -1 if not seen yet
+	Debounce m_stream_debounce;
+
+	// streaming decode : timing, from pulse durations so far
+	DurationHistogram m_stream_on_hist;
+	bool m_stream_timing_known = false;
+	double m_stream_on_threshold = 0;
+	double m_stream_letter_gap = 0, m_stream_word_gap = 0;
+	std::deque<Signal> m_stream_backlog; // received before timing known
+
+	// streaming decode : output
+	MorseCode m_stream_code; // of symbol being received
+	std::string m_message; // decoded, of the first area
+	int m_unknown_symbols = 0; // patterns in the message that aren't symbols
+	std::vector<std::string> m_unknown_patterns; // first few distinct ones
+	bool m_stream_word = false; // letters since last word gap
+};
+
+VideoMorseDecode::VideoMorseDecode()
+{
+	m_frame_luminance_histogram.resize(256);
+}
+
+// should frame 'frame_index' be examined?
+bool VideoMorseDecode::frameWanted(int frame_index) const
+{
+	if (m_options.start_frame != -1 && frame_index < m_options.start_frame) {
+		return false;
+	}
+
+	if (m_options.end_frame != -1 && frame_index > m_options.end_frame) {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+average of 'component' over each of 'areas', which are in pixels of the
+picture. the areas are summed a row of the frame at a time, so each row
+is read once however many areas cross it.
+*/
+void VideoMorseDecode::averageAreas(
+	const Component & component, const std::vector<Rect> & areas,
+	std::vector<unsigned> & averages
+)
+{
+	// areas in samples of the component, rounded outwards if subsampled
+	std::vector<Rect> samples(areas.size());
+	int top = std::numeric_limits<int>::max(), bottom = 0;
+	for (size_t i = 0; i < areas.size(); i++) {
+		samples[i] = {
+			areas[i].x0 >> component.log2_w,
+			areas[i].y0 >> component.log2_h,
+			(areas[i].x1 + (1 << component.log2_w) - 1) >> component.log2_w,
+			(areas[i].y1 + (1 << component.log2_h) - 1) >> component.log2_h
+		};
+		top = std::min(top, samples[i].y0);
+		bottom = std::max(bottom, samples[i].y1);
+	}
+
+	std::vector<uint64_t> totals(areas.size());
+	for (int y = top; y < bottom; y++) {
+		const uint8_t *row = component.data + y * component.linesize;
+		for (size_t i = 0; i < samples.size(); i++) {
+			const Rect & area = samples[i];
+			if (y >= area.y0 && y < area.y1) {
+				totals[i] += sumSamples(row + area.x0 * component.step,
+					area.x1 - area.x0, component.step);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < samples.size(); i++) {
+		const Rect & area = samples[i];
+		averages[i] = totals[i]
+			/ ((uint64_t)(area.x1 - area.x0) * (area.y1 - area.y0));
+	}
+}
+
+/*
+the component examined in a decoded frame, or if it can't be read
+directly, in the crop converted from it
+*/
+Component VideoMorseDecode::measuredComponent(const AVFrame *frame)
+{
+	if (!m_convert) {
+		return getComponent(frame->data, frame->linesize,
+			m_desc, m_component_index);
+	}
+
+	const uint8_t *crop_data[4];
+	cropPlanes(frame, m_desc, m_crop.x0, m_crop.y0, crop_data);
+	sws_scale(m_sws_ctx, crop_data,
+		frame->linesize, 0, m_crop.y1 - m_crop.y0,
+		m_frame_converted->data, m_frame_converted->linesize
+	);
+	return getComponent(m_frame_converted->data,
+		m_frame_converted->linesize, m_convert_desc, m_component_index);
+}
+
+/*
+average luminance of each area in a decoded frame, after moving them to
+follow the lamps with --track. the areas are followed in the luma of the
+decoded frame if it has it, so only the crop around where they are now is
+converted; otherwise the whole frame is converted, and they're followed
+in that.
+*/
+void VideoMorseDecode::measureAreas(
+	const AVFrame *frame, std::vector<unsigned> & luminance
+)
+{
+	if (m_track_index >= 0 && trackAreas(getComponent(frame->data,
+		frame->linesize, m_desc, m_track_index)) && m_convert
+	) {
+		setupCrop();
+		setupConverter();
+	}
+
+	const Component component = measuredComponent(frame);
+	if (m_track_index < 0 && trackAreas(component) && m_convert) {
+		// the whole frame is converted, so the crop doesn't move
+		setupCrop();
+	}
+	averageAreas(component, m_convert ? m_crop_areas : m_areas, luminance);
+}
+
+// --track : move the areas to where the lamps are now. true if any moved.
+bool VideoMorseDecode::trackAreas(const Component & component)
+{
+	bool moved = false;
+	for (size_t i = 0; i < m_trackers.size(); i++) {
+		if (m_trackers[i].update(component)) {
+			Rect & area = m_areas[i];
+			m_trackers[i].area(area.x0, area.y0, area.x1, area.y1);
+			moved = true;
+		}
+	}
+	return moved;
+}
+
+void VideoMorseDecode::processFrame(const Sample & sample)
+{
+	m_frame_luminance_histogram[sample.luminance]++;
+
+	uint8_t discarded;
+	if (m_frames.push_back(sample.frame_index, sample.luminance,
+		sample.timestamp, discarded)
+	) {
+		m_frame_luminance_histogram[discarded]--;
+	}
+
+	int state = -1;
+	double threshold = 0;
+	if (m_options.threshold == THRESHOLD_ADAPTIVE) {
+		threshold = m_adaptive.threshold();
+		state = m_adaptive.update(sample.luminance);
+		adaptiveFrame(sample.frame_index,
+			edgeTime(m_frames.size() - 1, threshold), std::max(state, 0));
+	}
+
+	if (m_options.stream) {
+		streamFrame(sample, state, threshold);
+	}
+}
+
+/*
+time of the i'th frame kept, or if the luminance crossed 'threshold'
+between it and the frame before, the time it crossed, interpolated
+between the frames (linear), or the two frames before and this one
+(parabolic). without interpolation, edges are at the first frame of
+the new state.
+*/
+int64_t VideoMorseDecode::edgeTime(size_t i, double threshold) const
+{
+	const int64_t t1 = m_frames.time(i);
+	if (m_options.interpolate == INTERPOLATE_NONE || i == 0) {
+		return t1;
+	}
+
+	const double l0 = m_frames.luminance(i - 1), l1 = m_frames.luminance(i);
+	if ((l0 >= threshold) == (l1 >= threshold)) {
+		return t1;
+	}
+
+	// fraction of the way from frame i - 1 to frame i
+	double u = (threshold - l0) / (l1 - l0);
+	if (m_options.interpolate == INTERPOLATE_PARABOLIC && i >= 2) {
+		// l(u) = a u^2 + b u + l0 through frames i - 2, i - 1 and i, at
+		// u = -1, 0 and 1
+		const double lm = m_frames.luminance(i - 2);
+		const double a = (lm + l1) / 2 - l0, b = (l1 - lm) / 2;
+		const double c = l0 - threshold;
+		const double discriminant = b * b - 4 * a * c;
+		if (std::abs(a) > 1e-9 && discriminant >= 0) {
+			const double root = std::sqrt(discriminant);
+			for (const double r : { (-b + root) / (2 * a), (-b - root) / (2 * a) }) {
+				if (r >= 0 && r <= 1) {
+					u = r;
+					break;
+				}
+			}
+		}
+	}
+
+	const int64_t t0 = m_frames.time(i - 1);
+	return t0 + int64_t(std::round(u * (t1 - t0)));
+}
+
+// adaptive threshold : add a signal for each change of state, as
+// processStateChanges() does for the other thresholds
+void VideoMorseDecode::adaptiveFrame(int frame_index, int64_t time, int state)
+{
+	Signal signal;
+	if (!m_adaptive_debounce.update(frame_index, time, state,
+		signal.state, signal.duration)
+	) {
+		return;
+	}
+
+	m_signals.push_back(signal);
+	m_signals_duration += signal.duration;
+
+	// only keep signals for the frames kept
+	const int64_t kept = time - m_frames.time(0);
+	while (m_signals_duration - m_signals.front().duration >= kept
+		&& m_signals.size() > 1
+	) {
+		m_signals_duration -= m_signals.front().duration;
+		m_signals.pop_front();
+	}
+}
+
+/*
+streaming decode : the threshold is the mean luminance so far (whichever
+threshold is used for the report), once the luminance has varied enough
+to include pulses, or 'adaptive_state' and 'adaptive_threshold' with the
+adaptive threshold. state changes give signals as in
+processStateChanges(), and letters are printed as soon as the gap after
+them is long enough, rather than when the next pulse starts.
+*/
+void VideoMorseDecode::streamFrame(
+	const Sample & sample, int adaptive_state, double adaptive_threshold
+)
+{
+	int state = adaptive_state;
+	double threshold = adaptive_threshold;
+
+	if (m_options.threshold != THRESHOLD_ADAPTIVE) {
+		const unsigned min_contrast = AdaptiveThreshold::min_contrast;
+
+		m_stream_luminance_total += sample.luminance;
+		m_stream_frames++;
+		m_stream_min_luminance = std::min(m_stream_min_luminance, sample.luminance);
+		m_stream_max_luminance = std::max(m_stream_max_luminance, sample.luminance);
+
+		const unsigned contrast = m_stream_max_luminance - m_stream_min_luminance;
+		if (contrast >= min_contrast) {
+			state = m_stream_raw_state = hysteresisState(sample.luminance,
+				double(m_stream_luminance_total) / m_stream_frames,
+				m_options.hysteresis * contrast / 2, m_stream_raw_state);
+			// the mean is low until there have been a few pulses, so
+			// interpolate edges half way between the extremes
+			threshold = (m_stream_min_luminance + m_stream_max_luminance) / 2.0;
+		}
+	}
+
+	if (state == -1) {
+		return;
+	}
+
+	const size_t last = m_frames.size() - 1;
+	const int64_t time = m_frames.time(last);
+	const int64_t edge = edgeTime(last, threshold);
+
+	if (m_stream_state == -1) {
+		// contrast is first seen when the first pulse starts
+		m_stream_state = state;
+		m_stream_debounce.start(edge, state);
+		if (state == 1) {
+			m_stream_last_change = edge;
+		}
+		return;
+	}
+
+	Signal signal;
+	if (m_stream_debounce.update(sample.frame_index, edge, state,
+		signal.state, signal.duration)
+	) {
+		// the first signal started before there was a threshold
+		if (m_stream_last_change != -1) {
+			streamSignal(signal);
+		}
+		m_stream_state = m_stream_debounce.state();
+		m_stream_last_change = m_stream_debounce.lastChange();
+	} else if (m_stream_state == 0 && m_stream_last_change != -1
+		&& m_stream_timing_known
+	) {
+		// gap so far
+		streamGap(time - m_stream_last_change);
+	}
+}
+
+void VideoMorseDecode::streamSignal(const Signal & signal)
+{
+	if (signal.state == 1) {
+		// dot and dash durations, from the two most common pulse durations.
+		// a dash is 3 units, a dot 1, the gap between letters 3 and between
+		// words 7.
+		m_stream_on_hist.add(signal.duration);
+		auto peaks = get_local_maximums(m_stream_on_hist.dense(), 2,
+			m_smoothing_kernel);
+		std::sort(std::begin(peaks), std::end(peaks));
+		if (peaks.size() == 2 && peaks[1] >= 2 * peaks[0]) {
+			const double bin_width = m_stream_on_hist.binWidth();
+			const double unit = (peaks[0] + peaks[1] / 3.0) / 2 * bin_width;
+			m_stream_on_threshold = (peaks[0] + peaks[1]) / 2.0 * bin_width;
+			m_stream_letter_gap = 2 * unit;
+			m_stream_word_gap = 5 * unit;
+			m_stream_timing_known = true;
+		}
+	}
+
+	if (!m_stream_timing_known) {
+		// no dashes (or no dots) yet, so nothing can be decoded
+		const size_t max_backlog = 4096;
+		m_stream_backlog.push_back(signal);
+		if (m_stream_backlog.size() > max_backlog) {
+			m_stream_backlog.pop_front();
+		}
+		return;
+	}
+
+	for (const auto & s : m_stream_backlog) {
+		streamElement(s);
+	}
+	m_stream_backlog.clear();
+
+	streamElement(signal);
+}
+
+void VideoMorseDecode::streamElement(const Signal & signal)
+{
+	if (signal.state == 1) {
+		m_stream_code.add(signal.duration >= m_stream_on_threshold);
+	} else {
+		streamGap(signal.duration);
+	}
+}
+
+// called as a gap grows, and when it ends
+void VideoMorseDecode::streamGap(int64_t duration)
+{
+	if (duration >= m_stream_letter_gap && !m_stream_code.empty()) {
+		std::cout << decodeSymbol(m_stream_code) << std::flush;
+		m_stream_code.clear();
+		m_stream_word = true;
+	}
+	if (duration >= m_stream_word_gap && m_stream_word) {
+		std::cout << " " << std::flush;
+		m_stream_word = false;
+	}
+}
+
+void VideoMorseDecode::streamFinish()
+{
+	if (m_stream_timing_known) {
+		streamGap(m_stream_word_gap);
+	} else if (!m_stream_backlog.empty()) {
+		std::cerr << "couldn't find dot and dash durations\n";
+	}
+	std::cout << "\n";
+}
+
+void VideoMorseDecode::calculateHistogram()
+{
+	unsigned i, n, yi, j, y, sum = 0, max = 0;
+
+	m_mean_luminance = 0;
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < 16; j++) {
+			n = i * 16 + j;
+			m_mean_luminance += n * m_frame_luminance_histogram[n];
+			sum += m_frame_luminance_histogram[n];
+		}
+	}
+	m_mean_luminance /= std::max(sum, 1u);
+
+	std::string delim = "";
+
+	*m_json_stream << "\"frame_hist\": [";
+	for (const auto & e : m_frame_luminance_histogram) {
+		*m_json_stream << delim << e;
+		delim = ",";
+	}
+	*m_json_stream << "]\n";
+
+	*m_json_stream << ",\"frame_hist_mean\": " << m_mean_luminance << "\n";
+}
+
+// choose the threshold for processStateChanges() from the histogram
+void VideoMorseDecode::calculateThreshold()
+{
+	switch (m_options.threshold) {
+	case THRESHOLD_OTSU :
+		m_threshold = otsuThreshold(m_frame_luminance_histogram);
+		break;
+	case THRESHOLD_KMEANS :
+		m_threshold = kmeansThreshold(m_frame_luminance_histogram);
+		break;
+	default :
+		m_threshold = m_mean_luminance;
+		break;
+	}
+
+	// a capture with low separability is mostly noise, or has no pulses
+	*m_json_stream << ",\"threshold_luminance\": " << m_threshold << "\n";
+	*m_json_stream << ",\"separability\": "
+		<< separability(m_frame_luminance_histogram, m_threshold, &m_contrast)
+		<< "\n";
+}
+
+void VideoMorseDecode::processStateChanges()
+{
+	const double margin = m_options.hysteresis * m_contrast / 2;
+	Debounce debounce;
+	debounce.setMinRun(m_options.debounce);
+	int state = 0;
+
+	// frames at least m_threshold bright are on, so the edge is half a
+	// level below it
+	const double edge_threshold = m_threshold - 0.5;
+
+	for (size_t i = 0; i < m_frames.size(); i++) {
+		state = hysteresisState(m_frames.luminance(i), m_threshold, margin,
+			state);
+		Signal signal;
+		if (debounce.update(m_frames.index(i), edgeTime(i, edge_threshold),
+			state, signal.state, signal.duration)
+		) {
+			m_signals.push_back(signal);
+		}
+	}
+}
+
+void VideoMorseDecode::processSignals()
+{
+	DurationHistogram off_hist, on_hist;
+	off_hist.setBinWidth(m_histogram_bin);
+	on_hist.setBinWidth(m_histogram_bin);
+
+	for (const auto & signal : m_signals) {
+		if (signal.state == 0) {
+			off_hist.add(signal.duration);
+		} else {
+			on_hist.add(signal.duration);
+		}
+	}
+
+	// too few peaks (eg. a short or empty recording) : the missing
+	// thresholds are never reached, so all gaps are element gaps, or all
+	// pulses dots
+	const int64_t never = std::numeric_limits<int64_t>::max();
+
+	// peaks are bins, durations are multiples of the bin width
+	std::vector<int64_t> off_time_peaks;
+	for (const int bin : get_local_maximums(off_hist.dense(), 3, m_smoothing_kernel)) {
+		off_time_peaks.push_back(bin * m_histogram_bin);
+	}
+	std::sort(std::begin(off_time_peaks), std::end(off_time_peaks));
+
+	std::vector<int64_t> & off_thresholds = m_off_thresholds;
+	off_thresholds.assign(2, never);
+	for (size_t i = 0; i + 1 < off_time_peaks.size(); i++) {
+		off_thresholds[i] = (off_time_peaks[i] + off_time_peaks[i + 1]) / 2;
+	}
+
+	std::vector<int64_t> on_time_peaks;
+	for (const int bin : get_local_maximums(on_hist.dense(), 2, m_smoothing_kernel)) {
+		on_time_peaks.push_back(bin * m_histogram_bin);
+	}
+	std::sort(std::begin(on_time_peaks), std::end(on_time_peaks));
+
+	std::vector<int64_t> & on_thresholds = m_on_thresholds;
+	on_thresholds.assign(1, never);
+	if (on_time_peaks.size() == 2) {
+		on_thresholds[0] = (on_time_peaks[0] + on_time_peaks[1]) / 2;
+	}
+
+	std::string delim;
+
+	*m_json_stream << ",\"hist_off\": [";
+	delim = "";
+	off_hist.forEach([&](int64_t duration, int frequency) {
+		*m_json_stream << delim << "{\"" << duration << "\": " << frequency << "}";
+		delim = ",";
+	});
+	*m_json_stream << "]\n";
+
+	*m_json_stream << ",\"hist_on\": [";
+	delim = "";
+	on_hist.forEach([&](int64_t duration, int frequency) {
+		*m_json_stream << delim << "{\"" << duration << "\": " << frequency << "}";
+		delim = ",";
+	});
+	*m_json_stream << "]\n";
+
+	*m_json_stream << ",\"off_time_peaks\": [";
+	delim = "";
+	for (const auto & e : off_time_peaks) {
+		*m_json_stream << delim << e;
+		delim = ",";
+	}
+	*m_json_stream << "]\n";
+
+	*m_json_stream << ",\"off_thresholds\": [";
+	delim = "";
+	for (const auto & e : off_thresholds) {
+		*m_json_stream << delim << e;
+		delim = ",";
+	}
+	*m_json_stream << "]\n";
+
+	*m_json_stream << ",\"on_time_peaks\": [";
+	delim = "";
+	for (const auto & e : on_time_peaks) {
+		*m_json_stream << delim << e;
+		delim = ",";
+	}
+	*m_json_stream << "]\n";
+
+	*m_json_stream << ",\"on_thresholds\": [";
+	delim = "";
+	for (const auto & e : on_thresholds) {
+		*m_json_stream << delim << e;
+		delim = ",";
 	}
 	*m_json_stream << "]\n";
 
-	*m_json_stream << ",\"on_thresholds\": [";
-	delim = "";
-	for (const auto & e : on_thresholds) {
-		*m_json_stream << delim << e;
-		delim = ",";
+}
+
+VideoMorseDecode::Element VideoMorseDecode::classifySignal(
+	const Signal & signal
+) const
+{
+	if (signal.state == 0) {
+		if (signal.duration < m_off_thresholds[0]) {
+			return ELEMENT_GAP;
+		} else if (signal.duration < m_off_thresholds[1]) {
+			return LETTER_GAP;
+		}
+		return WORD_GAP;
+	}
+	return signal.duration < m_on_thresholds[0] ? DOT : DASH;
+}
+
+// the symbol in the chosen alphabet, or morse_unknown
+const char *VideoMorseDecode::decodeSymbol(const MorseCode & code) const
+{
+	const char *symbol = NULL;
+	if (m_options.prosigns) {
+		symbol = morse_prosign_table.lookup(code.code());
+	}
+	if (!symbol) {
+		symbol = morse_tables[m_options.alphabet].lookup(code.code());
+	}
+	return symbol ? symbol : morse_unknown;
+}
+
+// decode the message from the signals, a symbol at a time
+std::string VideoMorseDecode::decodeSignals()
+{
+	const size_t max_unknown_patterns = 16;
+	std::string message;
+	MorseCode code;
+
+	auto add_symbol = [&]() {
+		const char *symbol = decodeSymbol(code);
+		if (symbol == morse_unknown) {
+			m_unknown_symbols++;
+			const std::string pattern = code.pattern();
+			if (m_unknown_patterns.size() < max_unknown_patterns
+				&& std::find(m_unknown_patterns.begin(), m_unknown_patterns.end(), pattern)
+					== m_unknown_patterns.end()
+			) {
+				m_unknown_patterns.push_back(pattern);
+			}
+		}
+		message += symbol;
+		code.clear();
+	};
+
+	for (const auto & signal : m_signals) {
+		const Element element = classifySignal(signal);
+		switch (element) {
+		case DOT :
+		case DASH :
+			code.add(element == DASH);
+			break;
+		case ELEMENT_GAP :
+			break;
+		case LETTER_GAP :
+		case WORD_GAP :
+			if (!code.empty()) {
+				add_symbol();
+			}
+			if (element == WORD_GAP) {
+				message += " ";
+			}
+			break;
+		}
+	}
+
+	if (!code.empty()) {
+		add_symbol();
+	}
+
+	return message;
+}
+
+// the signals as dots and dashes, with | between words
+std::string VideoMorseDecode::morseText() const
+{
+	std::string morse;
+
+	for (const auto & signal : m_signals) {
+		switch (classifySignal(signal)) {
+		case DOT :
+			morse += ".";
+			break;
+		case DASH :
+			morse += "-";
+			break;
+		case ELEMENT_GAP :
+			break;
+		case LETTER_GAP :
+			morse += " ";
+			break;
+		case WORD_GAP :
+			morse += " | ";
+			break;
+		}
+	}
+
+	return morse;
+}
+
+bool VideoMorseDecode::parseOptions(int argc, char *argv[])
+{
+	std::vector<std::string> args;
+	bool valid = true;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--full-frame") {
+			m_options.full_frame = true;
+		} else if (arg == "--convert") {
+			m_options.convert = true;
+		} else if (arg == "--threads" && i + 1 < argc) {
+			m_options.threads = stringTo<int>(argv[++i]);
+			if (m_options.threads < 0) {
+				std::cerr << "invalid thread count\n";
+				valid = false;
+			}
+		} else if (arg == "--stream") {
+			m_options.stream = true;
+		} else if (arg == "--no-morse") {
+			m_options.morse_text = false;
+		} else if (arg == "--alphabet" && i + 1 < argc) {
+			const std::string alphabet = argv[++i];
+			const auto begin = std::begin(morse_alphabets), end = std::end(morse_alphabets);
+			const auto found = std::find(begin, end, alphabet);
+			if (found == end) {
+				std::cerr << "unknown alphabet " << alphabet << "\n";
+				valid = false;
+			}
+			m_options.alphabet = found == end ? 0 : found - begin;
+		} else if (arg == "--prosigns") {
+			m_options.prosigns = true;
+		} else if (arg == "--batch" && i + 1 < argc) {
+			m_options.batch_file_name = argv[++i];
+		} else if (arg == "--jobs" && i + 1 < argc) {
+			m_options.jobs = stringTo<int>(argv[++i]);
+			if (m_options.jobs < 0) {
+				std::cerr << "invalid job count\n";
+				valid = false;
+			}
+		} else if (arg == "--live") {
+			m_options.live = true;
+		} else if (arg == "--format" && i + 1 < argc) {
+			m_options.input_format = argv[++i];
+		} else if (arg == "--history" && i + 1 < argc) {
+			m_options.history = stringTo<int>(argv[++i]);
+			if (m_options.history < 0) {
+				std::cerr << "invalid history\n";
+				valid = false;
+			}
+		} else if (arg == "--threshold" && i + 1 < argc) {
+			const std::string method = argv[++i];
+			const auto begin = std::begin(threshold_methods), end = std::end(threshold_methods);
+			const auto found = std::find(begin, end, method);
+			if (found == end) {
+				std::cerr << "unknown threshold " << method << "\n";
+				valid = false;
+			}
+			m_options.threshold = ThresholdMethod(found == end ? 0 : found - begin);
+		} else if (arg == "--adapt-frames" && i + 1 < argc) {
+			m_options.adapt_frames = stringTo<int>(argv[++i]);
+			if (m_options.adapt_frames < 1) {
+				std::cerr << "invalid adaptive threshold time constant\n";
+				valid = false;
+			}
+		} else if (arg == "--hysteresis" && i + 1 < argc) {
+			m_options.hysteresis = stringTo<double>(argv[++i]);
+			if (!(m_options.hysteresis >= 0 && m_options.hysteresis < 1)) {
+				std::cerr << "invalid hysteresis\n";
+				valid = false;
+			}
+		} else if (arg == "--debounce" && i + 1 < argc) {
+			m_options.debounce = stringTo<int>(argv[++i]);
+			if (m_options.debounce < 1) {
+				std::cerr << "invalid debounce\n";
+				valid = false;
+			}
+		} else if (arg == "--interpolate" && i + 1 < argc) {
+			const std::string method = argv[++i];
+			const auto begin = std::begin(interpolation_methods), end = std::end(interpolation_methods);
+			const auto found = std::find(begin, end, method);
+			if (found == end) {
+				std::cerr << "unknown interpolation " << method << "\n";
+				valid = false;
+			}
+			m_options.interpolate = Interpolation(found == end ? 0 : found - begin);
+		} else if (arg == "--histogram-bin" && i + 1 < argc) {
+			m_options.histogram_bin = stringTo<int>(argv[++i]);
+			if (m_options.histogram_bin < 0 || (m_options.histogram_bin
+				&& m_options.histogram_bin < DurationHistogram::min_bin_width)
+			) {
+				std::cerr << "invalid histogram bin\n";
+				valid = false;
+			}
+		} else if (arg == "--smooth-window" && i + 1 < argc) {
+			m_options.smooth_window = stringTo<int>(argv[++i]);
+			if (m_options.smooth_window < 0) {
+				std::cerr << "invalid smoothing window\n";
+				valid = false;
+			}
+		} else if (arg == "--smooth-sigma" && i + 1 < argc) {
+			m_options.smooth_sigma = stringTo<double>(argv[++i]);
+			if (!(m_options.smooth_sigma > 0)) {
+				std::cerr << "invalid smoothing sigma\n";
+				valid = false;
+			}
+		} else if (arg == "--area" && i + 1 < argc) {
+			std::string bounds = argv[++i];
+			std::replace(bounds.begin(), bounds.end(), ',', ' ');
+			std::istringstream ss(bounds);
+			Bounds area;
+			if (!(ss >> area.x0 >> area.y0 >> area.x1 >> area.y1)
+				|| !(ss >> std::ws).eof()
+			) {
+				std::cerr << "invalid area " << argv[i] << "\n";
+				valid = false;
+			}
+			m_options.areas.push_back(area);
+		} else if (arg == "--locate" && i + 1 < argc) {
+			m_options.locate = stringTo<int>(argv[++i]);
+			if (m_options.locate < 0) {
+				std::cerr << "invalid number of areas to locate\n";
+				valid = false;
+			}
+		} else if (arg == "--locate-cells" && i + 1 < argc) {
+			m_options.locate_cells = stringTo<int>(argv[++i]);
+			if (m_options.locate_cells < 1) {
+				std::cerr << "invalid number of cells\n";
+				valid = false;
+			}
+		} else if (arg == "--track") {
+			m_options.track = true;
+		} else if (arg == "--lowres" && i + 1 < argc) {
+			m_options.lowres = stringTo<int>(argv[++i]);
+			if (m_options.lowres < 0 || m_options.lowres > 3) {
+				std::cerr << "invalid lowres\n";
+				valid = false;
+			}
+		} else if (arg == "--fast-decode") {
+			m_options.fast_decode = true;
+		} else if (arg == "--compare-full") {
+			m_options.compare_full = true;
+		} else if (arg == "--no-seek") {
+			m_options.seek = false;
+		} else if (arg == "--channel" && i + 1 < argc) {
+			std::string channel = argv[++i];
+			if (channel.size() != 1
+				|| std::string("rgbyuv").find(channel[0]) == std::string::npos
+			) {
+				std::cerr << "unknown channel " << channel << "\n";
+				valid = false;
+			}
+			m_options.channel = channel[0];
+		} else if (arg.compare(0, 2, "--") == 0) {
+			std::cerr << "unknown option " << arg << "\n";
+			valid = false;
+		} else {
+			args.push_back(arg);
+		}
+	}
+
+	const bool batch = !m_options.batch_file_name.empty();
+	if (batch && (m_options.stream || m_options.live)) {
+		std::cerr << "--stream and --live can't be used with --batch\n";
+		valid = false;
+	}
+	if (m_options.locate && (m_options.stream || m_options.live
+		|| !m_options.areas.empty() || m_options.track)
+	) {
+		std::cerr << "--stream, --live, --area and --track can't be used with --locate\n";
+		valid = false;
+	}
+
+	if (!valid || args.size() != (batch ? 1 : 8)) {
+		std::cerr
+			<< "usage: " << argv[0]
+			<< " [--no-morse] [--alphabet <latin|cyrillic|greek>] [--prosigns]"
+			<< " [--stream] [--live] [--format <name>] [--history <frames>]"
+			<< " [--threshold <mean|adaptive|otsu|kmeans>] [--adapt-frames <n>]"
+			<< " [--hysteresis <fraction>] [--debounce <frames>]"
+			<< " [--interpolate <none|linear|parabolic>]"
+			<< " [--histogram-bin <us>] [--smooth-window <taps>] [--smooth-sigma <taps>]"
+			<< " [--threads <n>] [--no-seek] [--area <x0,y0,x1,y1>]..."
+			<< " [--locate <n>] [--locate-cells <n>] [--track]"
+			<< " [--lowres <n>] [--fast-decode] [--compare-full]"
+			<< " [--channel <r|g|b|y|u|v>] [--convert] [--full-frame]"
+			<< " <video_filename> <json_filename>"
+			<< " <start_frame> <end_frame>"
+			<< " <x0> <y0> <x1> <y1>"
+			<< "\n"
+			<< "       " << argv[0]
+			<< " --batch <manifest> [--jobs <n>] [options] <json_filename>"
+			<< "\n";
+		return false;
+	}
+
+	if (batch) {
+		m_options.json_file_name = args[0];
+		if (m_options.json_file_name == "-") {
+			m_json_stream = &std::cout;
+		} else {
+			m_json_file = std::ofstream(m_options.json_file_name);
+			m_json_stream = &m_json_file;
+		}
+		return true;
+	}
+
+	m_options.video_file_name = args[0];
+	m_options.json_file_name = args[1];
+	m_options.start_frame = stringTo<int>(args[2]);
+	m_options.end_frame = stringTo<int>(args[3]);
+	m_options.x0 = stringTo<double>(args[4]);
+	m_options.y0 = stringTo<double>(args[5]);
+	m_options.x1 = stringTo<double>(args[6]);
+	m_options.y1 = stringTo<double>(args[7]);
+
+	if (m_options.json_file_name == "-") {
+		m_json_stream = &std::cout;
+	} else {
+		m_json_file = std::ofstream(m_options.json_file_name);
+		m_json_stream = &m_json_file;
+	}
+
+	setup();
+	return true;
+}
+
+void VideoMorseDecode::setOptions(const Options & options, std::ostream & json)
+{
+	m_options = options;
+	m_json_stream = &json;
+	setup();
+}
+
+// state which depends on the options
+void VideoMorseDecode::setup()
+{
+	m_adaptive.setup(m_options.adapt_frames, m_options.hysteresis);
+	m_adaptive_debounce.setMinRun(m_options.debounce);
+	m_stream_debounce.setMinRun(m_options.debounce);
+
+	m_smoothing_kernel = gaussianKernel(m_options.smooth_window,
+		m_options.smooth_sigma);
+}
+
+// print 'error', and keep it for error(). returns false.
+bool VideoMorseDecode::fail(const char *error)
+{
+	std::cerr << error << "\n";
+	m_error = error;
+	return false;
+}
+
+bool VideoMorseDecode::openVideo()
+{
+	AVCodec *codec = NULL;
+	AVDictionary *options_dict = NULL;
+	AVInputFormat *input_format = NULL;
+	std::string url = m_options.video_file_name;
+
+	initFFmpeg();
+
+	if (!m_options.input_format.empty()) {
+		input_format = av_find_input_format(m_options.input_format.c_str());
+		if (input_format == NULL) {
+			return fail("unknown input format");
+		}
+	} else if (url.compare(0, 10, "/dev/video") == 0) {
+		input_format = av_find_input_format("video4linux2");
+	}
+	if (url == "-") {
+		url = "pipe:0";
+	}
+
+	// so that blocking reads of live input can be interrupted
+	m_format_context = avformat_alloc_context();
+	if (m_format_context == NULL) {
+		return fail("failed to allocate format context");
+	}
+	m_format_context->interrupt_callback.callback = interruptCallback;
+
+	if (avformat_open_input(
+		&m_format_context, url.c_str(), input_format, NULL) != 0
+	) {
+		return fail("failed to open video file");
+	}
+
+	// devices have no AVIOContext, pipes and network streams can't seek
+	m_live = m_options.live
+		|| (m_format_context->iformat->flags & AVFMT_NOFILE)
+		|| (m_format_context->pb && !m_format_context->pb->seekable);
+
+	if (avformat_find_stream_info(m_format_context, NULL) < 0) {
+		return fail("failed to find video stream");
+	}
+
+	av_dump_format(m_format_context, 0, m_options.video_file_name.c_str(), 0);
+
+	for (unsigned i = 0; i < m_format_context->nb_streams; i++) {
+		const auto & codec = m_format_context->streams[i]->codec;
+		if (codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+			m_video_stream = i;
+			break;
+		}
+	}
+
+	if (m_video_stream == -1) {
+		return fail("failed to find video stream");
+	}
+
+	m_codec_context = m_format_context->streams[m_video_stream]->codec;
+
+	codec = avcodec_find_decoder(m_codec_context->codec_id);
+	if (codec == NULL) {
+		return fail("unsupported video codec");
+	}
+
+	// frame threading delays output by a frame per thread, but keeps the
+	// order, so frame indexes are unchanged
+	m_codec_context->thread_count = m_options.threads;
+	m_codec_context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+	// decoded frames are handed to another thread, so must own their data
+	m_codec_context->refcounted_frames = 1;
+
+	// only the mean of each area is needed, not the detail : decode at
+	// reduced size, and without the deblocking filter, if asked. decoders
+	// which can skip the chroma planes do when only luma is read.
+	m_lowres = std::min<int>(m_options.lowres, codec->max_lowres);
+	m_codec_context->lowres = m_lowres;
+	if (m_options.fast_decode) {
+		m_codec_context->skip_loop_filter = AVDISCARD_ALL;
+		m_codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
+		if (m_options.channel == 'y') {
+			m_codec_context->flags |= AV_CODEC_FLAG_GRAY;
+		}
+	}
+
+	if (avcodec_open2(m_codec_context, codec, &options_dict) < 0) {
+		return fail("unsupported video codec");
+	}
+
+	return true;
+}
+
+bool VideoMorseDecode::setupArea()
+{
+	const int width = m_codec_context->width;
+	const int height = m_codec_context->height;
+	m_frame_width = width;
+	m_frame_height = height;
+	std::vector<Bounds> bounds = m_options.areas;
+	bounds.insert(bounds.begin(),
+		{ m_options.x0, m_options.y0, m_options.x1, m_options.y1 });
+
+	m_areas.clear();
+	for (const auto & b : bounds) {
+		const Rect area = {
+			(int)(width  * b.x0), (int)(height * b.y0),
+			(int)(width  * b.x1), (int)(height * b.y1)
+		};
+		if (area.x0 < 0 || area.y0 < 0
+			|| area.x1 > width || area.y1 > height
+			|| area.x1 <= area.x0 || area.y1 <= area.y0
+		) {
+			return fail("invalid area to examine");
+		}
+		m_areas.push_back(area);
+	}
+
+	// read the component straight from the decoded frame if possible,
+	// otherwise convert to a format which has it
+	m_desc = av_pix_fmt_desc_get(m_codec_context->pix_fmt);
+	m_component_index = findComponent(m_desc, m_options.channel);
+	// --locate measures the whole area searched, often most of the frame,
+	// so rather than convert it each frame, it examines the luma
+	if (m_options.locate && m_component_index < 0 && !m_options.convert) {
+		m_component_index = findComponent(m_desc, 'y');
+		if (m_component_index >= 0) {
+			std::cerr << "channel " << m_options.channel << " would have to be"
+				" converted, locating in the luma (y) instead\n";
+		}
+	}
+	m_convert = m_options.convert || m_component_index < 0;
+
+	if (!m_convert) {
+		return true;
+	}
+
+	m_convert_pix_fmt =
+		std::string("rgb").find(m_options.channel) != std::string::npos
+		? AV_PIX_FMT_RGB24 : AV_PIX_FMT_YUV444P;
+	m_convert_desc = av_pix_fmt_desc_get(m_convert_pix_fmt);
+	m_component_index = findComponent(m_convert_desc, m_options.channel);
+
+	// only the part of the frame containing the areas is converted, unless
+	// the pixel format can't be cropped, or --track has no luma to follow
+	// the areas in but the converted frame
+	m_crop_to_areas = !m_options.full_frame && canCrop(m_desc)
+		&& (!m_options.track || findComponent(m_desc, 'y') >= 0);
+	setupCrop();
+
+	m_frame_converted = av_frame_alloc();
+	if (m_frame_converted == NULL) {
+		return fail("failed to allocate frame");
+	}
+
+	// with --track, the crop moves and changes size with the areas, up
+	// to the whole frame
+	size_t frame_bytes = avpicture_get_size(m_convert_pix_fmt,
+		m_options.track ? width : m_crop.x1 - m_crop.x0,
+		m_options.track ? height : m_crop.y1 - m_crop.y0);
+	m_buffer = (uint8_t *)av_malloc(frame_bytes * sizeof(uint8_t));
+
+	setupConverter();
+	if (m_sws_ctx == NULL) {
+		return fail("unsupported pixel format");
+	}
+
+	return true;
+}
+
+/*
+the part of the frame converted : the whole frame, or the areas where they
+are now, with the top-left corner aligned to the chroma subsampling
+*/
+void VideoMorseDecode::setupCrop()
+{
+	m_crop = { 0, 0, m_frame_width, m_frame_height };
+	if (m_crop_to_areas) {
+		m_crop = m_areas[0];
+		for (const auto & area : m_areas) {
+			m_crop.x0 = std::min(m_crop.x0, area.x0);
+			m_crop.y0 = std::min(m_crop.y0, area.y0);
+			m_crop.x1 = std::max(m_crop.x1, area.x1);
+			m_crop.y1 = std::max(m_crop.y1, area.y1);
+		}
+		m_crop.x0 &= ~((1 << m_desc->log2_chroma_w) - 1);
+		m_crop.y0 &= ~((1 << m_desc->log2_chroma_h) - 1);
 	}
-	*m_json_stream << "]\n";
+	m_crop_areas.clear();
+	for (const auto & area : m_areas) {
+		m_crop_areas.push_back({
+			area.x0 - m_crop.x0, area.y0 - m_crop.y0,
+			area.x1 - m_crop.x0, area.y1 - m_crop.y0
+		});
+	}
+}
 
-	return morse;
+// conversion of a crop the size of m_crop, kept while its size is the same
+void VideoMorseDecode::setupConverter()
+{
+	const int crop_width = m_crop.x1 - m_crop.x0;
+	const int crop_height = m_crop.y1 - m_crop.y0;
+
+	m_sws_ctx = sws_getCachedContext(m_sws_ctx,
+		crop_width, crop_height,
+		m_codec_context->pix_fmt,
+		crop_width, crop_height,
+		m_convert_pix_fmt, SWS_BILINEAR,
+		NULL, NULL, NULL
+	);
+	avpicture_fill((AVPicture *)m_frame_converted, m_buffer, m_convert_pix_fmt,
+		crop_width, crop_height);
 }
 
-bool VideoMorseDecode::parseOptions(int argc, char *argv[])
+/*
+limit reading to the frames from start_frame : seek to the keyframe
+before it, so that only the frames from there need to be decoded.
+reading stops once end_frame has been decoded (decodeStage).
+*/
+void VideoMorseDecode::setupWindow()
 {
-	if (argc != 9) {
-		std::cerr
-			<< "usage: " << argv[0]
-			<< " <video_filename> <json_filename>"
-			<< " <start_frame> <end_frame>"
-			<< " <x0> <y0> <x1> <y1>"
-			<< "\n";
-		return false;
+	AVStream *stream = m_format_context->streams[m_video_stream];
+	const AVRational frame_rate =
+		av_guess_frame_rate(m_format_context, stream, NULL);
+	const bool known_frame_rate = frame_rate.num > 0 && frame_rate.den > 0;
+
+	m_frame_rate = frame_rate;
+	m_stream_start_time =
+		stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+
+	if (!m_options.seek || m_options.start_frame <= 0 || m_live) {
+		return;
 	}
 
-	m_options.video_file_name = argv[1];
-	m_options.json_file_name = argv[2];
-	m_options.start_frame = stringTo<int>(argv[3]);
-	m_options.end_frame = stringTo<int>(argv[4]);
-	m_options.x0 = stringTo<double>(argv[5]);
-	m_options.y0 = stringTo<double>(argv[6]);
-	m_options.x1 = stringTo<double>(argv[7]);
-	m_options.y1 = stringTo<double>(argv[8]);
+	if (!known_frame_rate) {
+		std::cerr << "unknown frame rate, decoding from first frame\n";
+		return;
+	}
 
-	if (m_options.json_file_name == "-") {
-		m_json_stream = &std::cout;
-	} else {
-		m_json_file = std::ofstream(m_options.json_file_name);
-		m_json_stream = &m_json_file;
+	const int64_t timestamp = m_stream_start_time + av_rescale_q(
+		m_options.start_frame, av_inv_q(frame_rate), stream->time_base);
+
+	if (av_seek_frame(m_format_context, m_video_stream, timestamp,
+		AVSEEK_FLAG_BACKWARD) < 0
+	) {
+		std::cerr << "failed to seek, decoding from first frame\n";
+		return;
 	}
+	avcodec_flush_buffers(m_codec_context);
 
-	return true;
+	m_seeked = true;
 }
 
-bool VideoMorseDecode::run()
+// frames kept, and the timing of the signals found in them
+void VideoMorseDecode::setupAnalysis(
+	const AVRational & frame_rate, const AVRational & time_base
+)
 {
-	// FFmpeg stuff
-	AVFormatContext *format_context = NULL;
-	AVCodecContext *codec_context = NULL;
-	AVCodec *codec = NULL;
-	AVFrame *frame = NULL;
-	AVFrame *frame_rgb = NULL;
-	AVDictionary *options_dict = NULL;
-	struct SwsContext *sws_ctx = NULL;
-	AVPacket packet;
+	m_frames.setCapacity(std::max(m_options.history, 0));
+	m_frames.setFrameRate(frame_rate, time_base);
+	// interpolated edges can be told apart at less than a frame
+	m_histogram_bin = m_options.histogram_bin ? m_options.histogram_bin
+		: m_options.interpolate == INTERPOLATE_NONE ? m_frames.frameDuration()
+		: m_frames.frameDuration() / 2;
+	// timing is estimated from the first few pulses, too few for fine bins
+	m_stream_on_hist.setBinWidth(m_options.histogram_bin
+		? m_options.histogram_bin : m_frames.frameDuration());
+}
 
-	unsigned frame_index = 0;
-	int video_stream = -1;
-	int frame_finished = 0;
-	size_t frame_bytes = 0;
-	uint8_t *buffer = NULL;
-	const char *video_file_name = NULL;
-	const char *json_file_name = NULL;
+void VideoMorseDecode::closeVideo()
+{
+	sws_freeContext(m_sws_ctx);
+	m_sws_ctx = NULL;
+	av_freep(&m_buffer);
+	av_frame_free(&m_frame_converted);
+	if (m_codec_context) {
+		avcodec_close(m_codec_context);
+		m_codec_context = NULL;
+	}
+	avformat_close_input(&m_format_context);
+}
 
-	av_register_all();
+// read packets of the video stream
+void VideoMorseDecode::demuxStage(SpscQueue<AVPacket *> & packets)
+{
+	AVPacket *packet = av_packet_alloc();
 
-	if (avformat_open_input(
-		&format_context, m_options.video_file_name.c_str(), NULL, NULL) != 0
+	while (packet && !m_stop && !interrupted
+		&& av_read_frame(m_format_context, packet) >= 0
 	) {
-		std::cerr << "failed to open video file\n";
-		return false;
+		if (packet->stream_index != m_video_stream) {
+			av_packet_unref(packet);
+			continue;
+		}
+		packets.push(packet);
+		packet = av_packet_alloc();
 	}
 
-	if (avformat_find_stream_info(format_context, NULL) < 0) {
-		std::cerr << "failed to find video stream\n";
-		return false;
-	}
+	av_packet_free(&packet);
+	packets.close();
+}
 
-	av_dump_format(format_context, 0, m_options.video_file_name.c_str(), 0);
+// decode packets to frames, numbering them and dropping unwanted ones
+void VideoMorseDecode::decodeStage(
+	SpscQueue<AVPacket *> & packets,
+	SpscQueue<DecodedFrame> & frames
+)
+{
+	AVFrame *frame = av_frame_alloc();
+	AVPacket *packet = NULL;
+	int frame_finished = 0;
+	bool done = false;
 
-	for (unsigned i = 0; i < format_context->nb_streams; i++) {
-		const auto & codec = format_context->streams[i]->codec;
-		if (codec->codec_type == AVMEDIA_TYPE_VIDEO) {
-			video_stream = i;
-			break;
+	auto output_frame = [&]() {
+		if (m_seeked && m_frames_decoded == 0) {
+			// number frames from the timestamp of the first frame decoded
+			const AVStream *stream = m_format_context->streams[m_video_stream];
+			const int64_t timestamp = av_frame_get_best_effort_timestamp(frame);
+			if (timestamp != AV_NOPTS_VALUE) {
+				m_next_frame_index = av_rescale_q(
+					timestamp - m_stream_start_time,
+					stream->time_base, av_inv_q(m_frame_rate));
+			} else {
+				std::cerr << "no timestamp after seeking, "
+					"frame numbers will be wrong, try --no-seek\n";
+			}
+		}
+
+		const int frame_index = m_next_frame_index++;
+		m_frames_decoded++;
+
+		// frames are numbered as they're decoded, so with dropped frames or
+		// a variable frame rate, the end of the window can't be found from
+		// the timestamps of the packets
+		if (m_options.end_frame != -1 && frame_index >= m_options.end_frame) {
+			done = true;
+		}
+		if (!frameWanted(frame_index)) {
+			av_frame_unref(frame);
+			return;
+		}
+		DecodedFrame decoded = { av_frame_alloc(), frame_index };
+		av_frame_move_ref(decoded.frame, frame);
+		frames.push(decoded);
+	};
+
+	while (!done && packets.pop(packet)) {
+		avcodec_decode_video2(m_codec_context, frame, &frame_finished, packet);
+		av_packet_free(&packet);
+		if (frame_finished) {
+			output_frame();
 		}
 	}
 
-	if (video_stream == -1) {
-		std::cerr << "failed to find video stream\n";
-		return false;
+	if (done) {
+		// stop demuxing, and discard what it has already read
+		m_stop = true;
+		while (packets.pop(packet)) {
+			av_packet_free(&packet);
+		}
+	} else {
+		// get frames still buffered by the decoder
+		AVPacket flush_packet;
+		av_init_packet(&flush_packet);
+		flush_packet.data = NULL;
+		flush_packet.size = 0;
+		do {
+			avcodec_decode_video2(m_codec_context, frame, &frame_finished,
+				&flush_packet);
+			if (frame_finished) {
+				output_frame();
+			}
+		} while (frame_finished && !done);
 	}
 
-	codec_context = format_context->streams[video_stream]->codec;
+	av_frame_free(&frame);
+	frames.close();
+}
 
-	codec = avcodec_find_decoder(codec_context->codec_id);
-	if (codec == NULL) {
-		std::cerr << "unsupported video codec\n";
-		return false;
+// measure the area in each frame
+void VideoMorseDecode::extractStage(
+	SpscQueue<DecodedFrame> & frames,
+	SpscQueue<Sample> & samples
+)
+{
+	DecodedFrame decoded;
+	std::vector<unsigned> luminance(m_areas.size());
+
+	while (frames.pop(decoded)) {
+		Sample sample;
+		sample.frame_index = decoded.frame_index;
+		sample.timestamp = av_frame_get_best_effort_timestamp(decoded.frame);
+		if (m_options.locate) {
+			// the frames of the areas found are replayed from the cells
+			m_grid.measure(measuredComponent(decoded.frame), sample.areas);
+			sample.luminance = 0;
+		} else {
+			measureAreas(decoded.frame, luminance);
+			sample.luminance = luminance[0];
+			sample.areas.assign(luminance.begin() + 1, luminance.end());
+		}
+		av_frame_free(&decoded.frame);
+		samples.push(sample);
 	}
 
-	if (avcodec_open2(codec_context, codec, &options_dict) < 0) {
-		std::cerr << "unsupported video codec\n";
+	samples.close();
+}
+
+void VideoMorseDecode::writeQueueStats(
+	const char *name, const QueueStats & stats
+)
+{
+	*m_json_stream << "\"" << name << "\": {"
+		<< "\"capacity\": " << stats.capacity
+		<< ", \"max_depth\": " << stats.max_depth
+		<< ", \"mean_depth\": " << stats.mean_depth
+		<< ", \"full_stalls\": " << stats.full_stalls
+		<< ", \"empty_stalls\": " << stats.empty_stalls
+		<< "}";
+}
+
+bool VideoMorseDecode::run()
+{
+	if (!openVideo() || !setupArea()) {
+		closeVideo();
 		return false;
 	}
 
-	frame = av_frame_alloc();
-	if (frame == NULL) {
-		std::cerr << "failed to allocate frame\n";
+	setupWindow();
+
+	if (m_live && !m_options.batch_file_name.empty()) {
+		closeVideo();
+		return fail("live input can't be used in a batch");
+	}
+	if (m_live && m_options.locate) {
+		closeVideo();
+		return fail("live input can't be used with --locate");
+	}
+	if (m_live && m_options.compare_full) {
+		closeVideo();
+		return fail("live input can't be decoded again with --compare-full");
+	}
+	if (m_options.locate && !setupGrid()) {
+		closeVideo();
 		return false;
 	}
+	if (m_options.track) {
+		setupTrackers();
+	}
 
-	frame_rgb = av_frame_alloc();
-	if (frame_rgb == NULL) {
-		std::cerr << "failed to allocate frame\n";
-		return false;
+	// live input never ends, so decode as it's read, and only keep recent
+	// frames. stop with ctrl-c to get the report.
+	if (m_live) {
+		const int default_live_history = 65536;
+		m_options.stream = true;
+		if (m_options.history == -1) {
+			m_options.history = default_live_history;
+		}
+		std::signal(SIGINT, onInterrupt);
 	}
+	const AVRational time_base =
+		m_format_context->streams[m_video_stream]->time_base;
+	setupAnalysis(m_frame_rate, time_base);
+	setupTracks(time_base);
 
-	frame_bytes = avpicture_get_size(AV_PIX_FMT_RGB24,
-		codec_context->width, codec_context->height);
-	buffer = (uint8_t *)av_malloc(frame_bytes * sizeof(uint8_t));
+	// packets are small, decoded frames are not
+	SpscQueue<AVPacket *> packets(64);
+	SpscQueue<DecodedFrame> frames(4);
+	SpscQueue<Sample> samples(256);
 
-	// convert to RGB24 pixel format
-	sws_ctx = sws_getContext(
-		codec_context->width, codec_context->height,
-		codec_context->pix_fmt,
-		codec_context->width, codec_context->height,
-		AV_PIX_FMT_RGB24, SWS_BILINEAR,
-		NULL, NULL, NULL
-	);
+	const auto start_time = std::chrono::steady_clock::now();
 
-	avpicture_fill((AVPicture *)frame_rgb, buffer, AV_PIX_FMT_RGB24,
-		codec_context->width, codec_context->height);
+	// demux -> decode -> extract -> analyse (this thread)
+	std::thread demux_thread(&VideoMorseDecode::demuxStage, this,
+		std::ref(packets));
+	std::thread decode_thread(&VideoMorseDecode::decodeStage, this,
+		std::ref(packets), std::ref(frames));
+	std::thread extract_thread(&VideoMorseDecode::extractStage, this,
+		std::ref(frames), std::ref(samples));
 
-	frame_index = 0;
-	while (av_read_frame(format_context, &packet) >= 0) {
-		if (packet.stream_index == video_stream) {
-			avcodec_decode_video2(codec_context, frame, &frame_finished, &packet);
-			if (frame_finished) {
-				sws_scale(sws_ctx, (uint8_t const * const *)frame->data,
-					frame->linesize, 0, codec_context->height,
-					frame_rgb->data, frame_rgb->linesize
-				);
-				processFrame(frame_rgb,
-					codec_context->width, codec_context->height, frame_index);
-				frame_index++;
-			}
+	Sample sample;
+	while (samples.pop(sample)) {
+		if (m_options.locate) {
+			scanFrame(sample);
+			continue;
+		}
+		processFrame(sample);
+		for (size_t i = 0; i < m_tracks.size(); i++) {
+			m_tracks[i]->processFrame(
+				{ sample.frame_index, sample.timestamp, sample.areas[i] });
 		}
-		av_free_packet(&packet);
+	}
+	if (m_options.stream) {
+		streamFinish();
+	}
+	if (m_options.locate) {
+		locateAreas();
+		setupTracks(time_base);
+		replayCandidates();
 	}
 
+	demux_thread.join();
+	decode_thread.join();
+	extract_thread.join();
+
+	const std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start_time;
+
+	// release the decoder and input before analysis
+	m_decode_threads = m_codec_context->thread_count;
+	closeVideo();
+
 	*m_json_stream << "{\n";
 
-	calculateHistogram();
-	processStateChanges();
+	analyse();
+	if (m_options.locate) {
+		*m_json_stream << ",\"area\": [" << m_options.x0 << ", " << m_options.y0
+			<< ", " << m_options.x1 << ", " << m_options.y1 << "]\n";
+	}
+
+	if (!m_tracks.empty()) {
+		*m_json_stream << ",\"areas\": [";
+		for (size_t i = 0; i < m_tracks.size(); i++) {
+			const Bounds & bounds = m_options.areas[i];
+			*m_json_stream << (i ? ", " : "") << "{\n";
+			m_tracks[i]->analyse();
+			*m_json_stream << ",\"area\": [" << bounds.x0 << ", " << bounds.y0
+				<< ", " << bounds.x1 << ", " << bounds.y1 << "]\n";
+			*m_json_stream << "}";
+		}
+		*m_json_stream << "]\n";
+	}
+	if (m_options.locate) {
+		writeCandidates();
+	}
+	if (m_options.track) {
+		writeTracking();
+	}
+
+	*m_json_stream << ",\"frames\": " << m_frames_decoded << "\n";
+	*m_json_stream << ",\"regular_timestamps\": "
+		<< (m_frames.regular() ? "true" : "false") << "\n";
+	*m_json_stream << ",\"frames_per_second\": "
+		<< m_frames_decoded / elapsed.count() << "\n";
+	*m_json_stream << ",\"decode_threads\": " << m_decode_threads << "\n";
+	if (m_options.lowres) {
+		*m_json_stream << ",\"lowres\": " << m_lowres << "\n";
+	}
 
-	auto morse = processSignals();
-	*m_json_stream << ",\"morse\": \"" << morse << "\"\n";
+	// full stalls : the stage after the queue is the bottleneck
+	// empty stalls : the stage before the queue is the bottleneck
+	*m_json_stream << ",\"queues\": {";
+	writeQueueStats("packets", packets.stats());
+	*m_json_stream << ", ";
+	writeQueueStats("frames", frames.stats());
+	*m_json_stream << ", ";
+	writeQueueStats("samples", samples.stats());
+	*m_json_stream << "}\n";
 
-	auto message = decodeMorse(morse);
-	*m_json_stream << ",\"message\": \"" << message << "\"\n";
+	if (m_options.compare_full) {
+		compareFull(m_frames_decoded / elapsed.count());
+	}
 
 	*m_json_stream << "}\n";
 
-	av_free(buffer);
-	av_free(frame_rgb);
-	av_free(frame);
-	avcodec_close(codec_context);
-	avformat_close_input(&format_context);
+	return true;
+}
+
+/*
+--compare-full : decode the video again at full resolution, without
+skipping anything, and report how much the luminance of the first area
+differs, whether the message does, and how much faster this decode was
+*/
+void VideoMorseDecode::compareFull(double frames_per_second)
+{
+	Options options = m_options;
+	options.lowres = 0;
+	options.fast_decode = false;
+	options.compare_full = false;
+	options.stream = false;
+
+	std::ostringstream json; // not needed, the results are compared here
+	VideoMorseDecode full;
+	full.setOptions(options, json);
+	const auto start_time = std::chrono::steady_clock::now();
+	if (!full.run()) {
+		*m_json_stream << ",\"compare_full\": {\"error\": \""
+			<< jsonEscape(full.error()) << "\"}\n";
+		return;
+	}
+	const std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start_time;
+	const double full_frames_per_second = full.m_frames_decoded / elapsed.count();
+
+	// frames kept by both, matched by index
+	const FrameStore & a = m_frames, & b = full.m_frames;
+	unsigned frames = 0, max_difference = 0;
+	double total_difference = 0;
+	for (size_t i = 0, j = 0; i < a.size() && j < b.size(); ) {
+		if (a.index(i) < b.index(j)) {
+			i++;
+		} else if (b.index(j) < a.index(i)) {
+			j++;
+		} else {
+			const unsigned difference = std::abs(a.luminance(i) - b.luminance(j));
+			max_difference = std::max(max_difference, difference);
+			total_difference += difference;
+			frames++;
+			i++;
+			j++;
+		}
+	}
+
+	*m_json_stream << ",\"compare_full\": {"
+		<< "\"frames\": " << frames
+		<< ", \"mean_luminance_difference\": "
+		<< (frames ? total_difference / frames : 0)
+		<< ", \"max_luminance_difference\": " << max_difference
+		<< ", \"same_message\": " << (m_message == full.m_message ? "true" : "false")
+		<< ", \"message\": \"" << jsonEscape(full.m_message) << "\""
+		<< ", \"frames_per_second\": " << full_frames_per_second
+		<< ", \"speedup\": " << frames_per_second / full_frames_per_second
+		<< "}\n";
+}
+
+// each --area is analysed separately, with the same options. only the
+// letters of the first area are streamed.
+void VideoMorseDecode::setupTracks(const AVRational & time_base)
+{
+	m_tracks.clear();
+	for (const auto & bounds : m_options.areas) {
+		Options options = m_options;
+		options.x0 = bounds.x0;
+		options.y0 = bounds.y0;
+		options.x1 = bounds.x1;
+		options.y1 = bounds.y1;
+		options.areas.clear();
+		options.locate = 0;
+		options.stream = false;
+
+		m_tracks.emplace_back(new VideoMorseDecode);
+		m_tracks.back()->setOptions(options, *m_json_stream);
+		m_tracks.back()->setupAnalysis(m_frame_rate, time_base);
+	}
+}
+
+/*
+--track : follow each area from where it's given, in the luma of the
+decoded frame whatever the channel measured, so that only the areas need
+be converted. formats without luma (eg. RGB) are followed in the channel.
+*/
+void VideoMorseDecode::setupTrackers()
+{
+	int log2_w, log2_h;
+	m_track_index = findComponent(m_desc, 'y');
+	if (m_track_index >= 0) {
+		componentSubsampling(m_desc, m_track_index, log2_w, log2_h);
+	} else {
+		componentSubsampling(m_convert ? m_convert_desc : m_desc,
+			m_component_index, log2_w, log2_h);
+	}
+	m_trackers.assign(m_areas.size(), AreaTracker());
+	for (size_t i = 0; i < m_areas.size(); i++) {
+		const Rect & area = m_areas[i];
+		m_trackers[i].setup(area.x0, area.y0, area.x1, area.y1,
+			m_frame_width, m_frame_height, log2_w, log2_h);
+	}
+}
+
+/*
+--locate : cover the area with a grid of cells, about square, which are
+measured in each frame instead of the area
+*/
+bool VideoMorseDecode::setupGrid()
+{
+	const Rect & area = m_convert ? m_crop_areas[0] : m_areas[0];
+	const int width = area.x1 - area.x0, height = area.y1 - area.y0;
+	const int columns = m_options.locate_cells;
+	const int rows = std::max((int)std::lround((double)columns * height / width), 1);
+	// at least 2 samples of the component each way, which may be subsampled
+	int log2_w, log2_h;
+	componentSubsampling(m_convert ? m_convert_desc : m_desc,
+		m_component_index, log2_w, log2_h);
+	if ((width >> log2_w) < 2 * columns || (height >> log2_h) < 2 * rows) {
+		return fail("too many cells for the area to search");
+	}
+	m_grid.setup(area.x0, area.y0, area.x1, area.y1, columns, rows);
+
+	// cells as fractions of the frame
+	const int x = m_convert ? m_crop.x0 : 0, y = m_convert ? m_crop.y0 : 0;
+	const double frame_width = m_codec_context->width;
+	const double frame_height = m_codec_context->height;
+	m_cell_bounds.resize(m_grid.size());
+	for (size_t i = 0; i < m_grid.size(); i++) {
+		int x0, y0, x1, y1;
+		m_grid.cell(i, x0, y0, x1, y1);
+		m_cell_bounds[i] = {
+			(x + x0) / frame_width, (y + y0) / frame_height,
+			(x + x1) / frame_width, (y + y1) / frame_height
+		};
+	}
+
+	m_cell_stats.assign(m_grid.size(), BlinkStats());
+	for (auto & stats : m_cell_stats) {
+		stats.setup(m_options.adapt_frames);
+	}
 
+	// only the last --history frames are kept to replay, as a byte per cell
+	// per frame adds up (eg. 250MB for 2 hours of 60fps with 32x18 cells)
+	const size_t history = std::max(m_options.history, 0);
+	m_scanned_frames.setCapacity(history);
+	m_cell_luminance.setCapacity(history * m_grid.size());
 	return true;
 }
 
+// --locate : keep the luminance of each cell, and how much it looks like a lamp
+void VideoMorseDecode::scanFrame(const Sample & sample)
+{
+	Sample discarded_frame;
+	uint8_t discarded_luminance;
+	m_scanned_frames.push_back({ sample.frame_index, sample.timestamp, 0 },
+		discarded_frame);
+	for (size_t i = 0; i < sample.areas.size(); i++) {
+		m_cell_stats[i].add(sample.areas[i]);
+		m_cell_luminance.push_back(sample.areas[i], discarded_luminance);
+	}
+}
+
+// --locate : correlation of the luminance of two cells over the frames
+double VideoMorseDecode::cellCorrelation(size_t a, size_t b) const
+{
+	const size_t cells = m_grid.size(), frames = m_scanned_frames.size();
+	double sum_a = 0, sum_b = 0, sum_aa = 0, sum_bb = 0, sum_ab = 0;
+	for (size_t i = 0; i < frames; i++) {
+		const double la = m_cell_luminance[i * cells + a];
+		const double lb = m_cell_luminance[i * cells + b];
+		sum_a += la;
+		sum_b += lb;
+		sum_aa += la * la;
+		sum_bb += lb * lb;
+		sum_ab += la * lb;
+	}
+	const double covariance = sum_ab - sum_a * sum_b / frames;
+	const double variance_a = sum_aa - sum_a * sum_a / frames;
+	const double variance_b = sum_bb - sum_b * sum_b / frames;
+	return variance_a > 0 && variance_b > 0
+		? covariance / std::sqrt(variance_a * variance_b) : 0;
+}
+
+/*
+--locate : choose the cells which look most like lamps. the cells around
+one which blink with it (their luminance is correlated) are the same lamp :
+the area found covers those which score at least half as much, and none of
+them are chosen again. the first area found is examined in place of the
+area searched, and the rest as if given with --area.
+*/
+void VideoMorseDecode::locateAreas()
+{
+	const int columns = m_grid.columns(), rows = m_grid.rows();
+	std::vector<size_t> order(m_grid.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+		return m_cell_stats[a].score() > m_cell_stats[b].score();
+	});
+
+	std::vector<bool> taken(m_grid.size());
+	m_candidates.clear();
+	for (size_t best : order) {
+		const double score = m_cell_stats[best].score();
+		if (score <= 0 || (int)m_candidates.size() == m_options.locate) {
+			break;
+		}
+		if (taken[best]) {
+			continue;
+		}
+
+		const double min_correlation = 0.9;
+		Candidate candidate;
+		candidate.best = best;
+		candidate.bounds = m_cell_bounds[best];
+		std::deque<size_t> lamp { best };
+		taken[best] = true;
+		while (!lamp.empty()) {
+			const size_t cell = lamp.front();
+			lamp.pop_front();
+			if (m_cell_stats[cell].score() >= score / 2) {
+				const Bounds & b = m_cell_bounds[cell];
+				candidate.cells.push_back(cell);
+				candidate.bounds.x0 = std::min(candidate.bounds.x0, b.x0);
+				candidate.bounds.y0 = std::min(candidate.bounds.y0, b.y0);
+				candidate.bounds.x1 = std::max(candidate.bounds.x1, b.x1);
+				candidate.bounds.y1 = std::max(candidate.bounds.y1, b.y1);
+			}
+
+			const int column = cell % columns, row = cell / columns;
+			for (int y = std::max(row - 1, 0); y <= std::min(row + 1, rows - 1); y++) {
+				for (int x = std::max(column - 1, 0); x <= std::min(column + 1, columns - 1); x++) {
+					const size_t next = y * columns + x;
+					if (!taken[next]
+						&& cellCorrelation(best, next) >= min_correlation
+					) {
+						taken[next] = true;
+						lamp.push_back(next);
+					}
+				}
+			}
+		}
+		m_candidates.push_back(candidate);
+	}
+
+	m_options.areas.clear();
+	if (m_candidates.empty()) {
+		std::cerr << "no blinking area found, examining the whole area\n";
+		return;
+	}
+	for (size_t i = 0; i < m_candidates.size(); i++) {
+		const Bounds & bounds = m_candidates[i].bounds;
+		if (i == 0) {
+			m_options.x0 = bounds.x0;
+			m_options.y0 = bounds.y0;
+			m_options.x1 = bounds.x1;
+			m_options.y1 = bounds.y1;
+		} else {
+			m_options.areas.push_back(bounds);
+		}
+	}
+}
+
+/*
+--locate : analyse the frames of the areas found, as if they'd been
+measured as they were read. the luminance of an area is the average of
+its cells.
+*/
+void VideoMorseDecode::replayCandidates()
+{
+	// the whole area if nothing was found
+	std::vector<std::vector<size_t>> areas;
+	for (const auto & candidate : m_candidates) {
+		areas.push_back(candidate.cells);
+	}
+	if (areas.empty()) {
+		areas.emplace_back();
+		for (size_t cell = 0; cell < m_grid.size(); cell++) {
+			areas.back().push_back(cell);
+		}
+	}
+
+	for (size_t frame = 0; frame < m_scanned_frames.size(); frame++) {
+		const size_t first_cell = frame * m_grid.size();
+		Sample sample = m_scanned_frames[frame];
+
+		for (size_t i = 0; i < areas.size(); i++) {
+			unsigned total = 0;
+			for (size_t cell : areas[i]) {
+				total += m_cell_luminance[first_cell + cell];
+			}
+			sample.luminance = total / areas[i].size();
+			if (i == 0) {
+				processFrame(sample);
+			} else {
+				m_tracks[i - 1]->processFrame(sample);
+			}
+		}
+	}
+}
+
+void VideoMorseDecode::writeCandidates()
+{
+	*m_json_stream << ",\"locate_grid\": [" << m_grid.columns()
+		<< ", " << m_grid.rows() << "]\n";
+	*m_json_stream << ",\"located\": [";
+	for (size_t i = 0; i < m_candidates.size(); i++) {
+		const Candidate & candidate = m_candidates[i];
+		const Bounds & bounds = candidate.bounds;
+		const BlinkStats & stats = m_cell_stats[candidate.best];
+		*m_json_stream << (i ? ", " : "")
+			<< "{\"area\": [" << bounds.x0 << ", " << bounds.y0
+			<< ", " << bounds.x1 << ", " << bounds.y1 << "]"
+			<< ", \"cells\": " << candidate.cells.size()
+			<< ", \"score\": " << stats.score()
+			<< ", \"pulses\": " << stats.pulses()
+			<< ", \"contrast\": " << stats.contrast()
+			<< ", \"separability\": " << stats.separability()
+			<< "}";
+	}
+	*m_json_stream << "]\n";
+}
+
+// --track : where each area ended up, as fractions of the frame
+void VideoMorseDecode::writeTracking()
+{
+	*m_json_stream << ",\"tracking\": [";
+	for (size_t i = 0; i < m_trackers.size(); i++) {
+		const Rect & area = m_areas[i];
+		*m_json_stream << (i ? ", " : "")
+			<< "{\"moves\": " << m_trackers[i].moves()
+			<< ", \"final_area\": [" << (double)area.x0 / m_frame_width
+			<< ", " << (double)area.y0 / m_frame_height
+			<< ", " << (double)area.x1 / m_frame_width
+			<< ", " << (double)area.y1 / m_frame_height << "]}";
+	}
+	*m_json_stream << "]\n";
+}
+
+/*
+find the threshold, signals and message from the frames read, and write
+them to the report
+*/
+void VideoMorseDecode::analyse()
+{
+	calculateHistogram();
+	*m_json_stream << ",\"threshold\": \""
+		<< threshold_methods[m_options.threshold] << "\"\n";
+	if (m_options.threshold == THRESHOLD_ADAPTIVE) {
+		// signals were found as frames were read
+		*m_json_stream << ",\"adaptive_levels\": ["
+			<< m_adaptive.offLevel() << "," << m_adaptive.onLevel() << "]\n";
+	} else {
+		calculateThreshold();
+		processStateChanges();
+	}
+
+	processSignals();
+	if (m_options.morse_text) {
+		*m_json_stream << ",\"morse\": \"" << morseText() << "\"\n";
+	}
+
+	m_message = decodeSignals();
+	*m_json_stream << ",\"message\": \"" << jsonEscape(m_message) << "\"\n";
+	*m_json_stream << ",\"unknown_symbols\": " << m_unknown_symbols << "\n";
+	*m_json_stream << ",\"unknown_patterns\": [";
+	for (size_t i = 0; i < m_unknown_patterns.size(); i++) {
+		*m_json_stream << (i ? ", " : "") << "\"" << m_unknown_patterns[i] << "\"";
+	}
+	*m_json_stream << "]\n";
+}
+
+/*
+decode each video in the manifest, a line each :
+<video_filename> <start_frame> <end_frame> <x0> <y0> <x1> <y1>
+with the other options as given. the report for each is written as a
+line of JSON Lines, as each finishes, with "job" (line of the manifest,
+from 1) and "video" added, or "error" if it couldn't be decoded.
+returns false if any couldn't be.
+*/
+bool VideoMorseDecode::runBatch()
+{
+	struct Job {
+		int line;
+		std::string video_file_name;
+		int start_frame, end_frame;
+		double x0, y0, x1, y1;
+	};
+	std::vector<Job> jobs;
+
+	std::ifstream manifest(m_options.batch_file_name);
+	if (!manifest) {
+		return fail("failed to open manifest");
+	}
+	std::string text;
+	for (int line = 1; std::getline(manifest, text); line++) {
+		if (text.find_first_not_of(" \t\r") == std::string::npos
+			|| text[text.find_first_not_of(" \t")] == '#'
+		) {
+			continue;
+		}
+		// the numbers are the last 6 fields, so file names can have spaces
+		std::vector<std::string> fields;
+		size_t end = text.find_last_not_of(" \t\r") + 1;
+		while (fields.size() < 6 && end != 0) {
+			const size_t start = text.find_last_of(" \t", end - 1);
+			const size_t begin = start == std::string::npos ? 0 : start + 1;
+			fields.push_back(text.substr(begin, end - begin));
+			end = begin ? text.find_last_not_of(" \t", begin - 1) + 1 : 0;
+		}
+		Job job;
+		job.line = line;
+		job.video_file_name = text.substr(0, end);
+		job.video_file_name.erase(0, job.video_file_name.find_first_not_of(" \t"));
+		if (fields.size() != 6 || job.video_file_name.empty()) {
+			std::cerr << m_options.batch_file_name << ":" << line
+				<< ": expected <video_filename> <start_frame> <end_frame>"
+				<< " <x0> <y0> <x1> <y1>\n";
+			return false;
+		}
+		job.start_frame = stringTo<int>(fields[5]);
+		job.end_frame = stringTo<int>(fields[4]);
+		job.x0 = stringTo<double>(fields[3]);
+		job.y0 = stringTo<double>(fields[2]);
+		job.x1 = stringTo<double>(fields[1]);
+		job.y1 = stringTo<double>(fields[0]);
+		jobs.push_back(job);
+	}
+
+	// many short videos decode faster a job per core with a decoding
+	// thread each, a few long ones with the cores shared out between them
+	const int cores = std::max<int>(std::thread::hardware_concurrency(), 1);
+	const int job_threads = m_options.jobs ? m_options.jobs
+		: std::max<int>(std::min<size_t>(cores, jobs.size()), 1);
+	Options options = m_options;
+	if (!options.threads) {
+		options.threads = std::max(cores / job_threads, 1);
+	}
+
+	std::mutex output_mutex;
+	std::atomic<bool> all_decoded { true };
+
+	WorkStealingPool pool(job_threads);
+	pool.run(jobs.size(), [&](size_t index) {
+		const Job & job = jobs[index];
+		Options job_options = options;
+		job_options.video_file_name = job.video_file_name;
+		job_options.start_frame = job.start_frame;
+		job_options.end_frame = job.end_frame;
+		job_options.x0 = job.x0;
+		job_options.y0 = job.y0;
+		job_options.x1 = job.x1;
+		job_options.y1 = job.y1;
+
+		std::ostringstream report;
+		std::shared_ptr<VideoMorseDecode> vmd =
+			std::make_shared<VideoMorseDecode>();
+		vmd->setOptions(job_options, report);
+
+		std::ostringstream line;
+		line << "{\"job\": " << job.line
+			<< ", \"video\": \"" << jsonEscape(job.video_file_name) << "\"";
+		if (vmd->run()) {
+			// the report as one line, after the fields above
+			std::string fields = report.str();
+			fields.erase(std::remove(fields.begin(), fields.end(), '\n'),
+				fields.end());
+			line << ", " << fields.substr(fields.find('{') + 1);
+		} else {
+			line << ", \"error\": \"" << jsonEscape(vmd->error()) << "\"}";
+			all_decoded = false;
+		}
+
+		std::lock_guard<std::mutex> lock(output_mutex);
+		*m_json_stream << line.str() << "\n" << std::flush;
+	});
+
+	return all_decoded;
+}
+
 int main(int argc, char *argv[])
 {
 	std::shared_ptr<VideoMorseDecode> vmd =
 		std::make_shared<VideoMorseDecode>();
 
-	vmd->parseOptions(argc, argv);
-	vmd->run();
+	if (!vmd->parseOptions(argc, argv)) {
+		return 1;
+	}
+	if (!vmd->options().batch_file_name.empty()) {
+		return vmd->runBatch() ? 0 : 1;
+	}
+	if (!vmd->run()) {
+		return 1;
+	}
 
 	return 0;
 }